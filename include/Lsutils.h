@@ -41,6 +41,7 @@
 #define PROPS_1(p1) ",\"properties\":{" p1 "}"
 #define PROPS_2(p1, p2) ",\"properties\":{" p1 "," p2 "}"
 #define PROPS_3(p1, p2, p3) ",\"properties\":{" p1 "," p2 "," p3 "}"
+#define PROPS_5(p1, p2, p3, p4, p5) ",\"properties\":{" p1 "," p2 "," p3 "," p4 "," p5 "}"
 #define STRICT_SCHEMA(attributes) "{\"type\":\"object\"" attributes ",\"additionalProperties\":false}"
 #define REQUIRED_1(p1) ",\"required\":[\"" #p1 "\"]"
 #define REQUIRED_2(p1, p2) ",\"required\":[\"" #p1 "\",\"" #p2 "\"]"
@@ -93,4 +94,8 @@ private:
 // build a standard json reply string without the overhead of using json schema
 std::string createJsonReplyString(bool returnValue = true, int errorCode = 0, const std::string& errorText = "" );
 
+// check whether any client is subscribed to the key, so that callers can skip building
+// subscription payloads nobody will receive
+bool hasSubscribers(LSHandle *lsHandle, const char *key);
+
 #endif /*MEDIA_CONTROL_SERVICE_H_*/
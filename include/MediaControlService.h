@@ -42,6 +42,8 @@ public:
 
   bool registerMediaSession(LSMessage &);
   bool unregisterMediaSession(LSMessage &);
+  bool registerMediaSessions(LSMessage &);
+  bool unregisterMediaSessions(LSMessage &);
   bool activateMediaSession(LSMessage &);
   bool deactivateMediaSession(LSMessage &);
   bool getMediaMetaData(LSMessage &);
@@ -49,6 +51,7 @@ public:
   bool getMediaSessionInfo(LSMessage &);
   bool getMediaSessionId(LSMessage &);
   bool getActiveMediaSessions(LSMessage &);
+  bool getMediaSessionSnapshot(LSMessage &);
   bool getMediaCoverArtPath(LSMessage &);
   bool setSupportedActions(LSMessage &);
   bool setMediaMetaData(LSMessage &);
@@ -67,7 +70,18 @@ public:
   int updateMetaDataResponse(const std::string &,  pbnjson::JObject &);
 
 private:
+  struct PlaybackInfoSnapshot {
+    unsigned long snapshotVersion = 0;
+    unsigned long positionVersion = 0;
+    //serialized full state, split where playPosition goes
+    std::string prefix;
+    std::string suffix;
+    std::string payload;
+  };
+
   void subscribeToBTAdapterGetStatus();
+  pbnjson::JValue buildPlaybackInfoPayload(const int &displayId, const std::string &eventType);
+  const std::string& getPlaybackInfoSnapshot(const int &displayId);
 #if USE_TEST_METHOD
   bool testKeyEvent(LSMessage &);
 #endif
@@ -75,6 +89,7 @@ private:
   LSHandle *lsHandle_;
   MediaSessionManager *ptrMediaSessionMgr_;
   MediaControlPrivate *ptrMediaControlPrivate_;
+  std::map<int, PlaybackInfoSnapshot> playbackInfoSnapshot_;
 };
 
 #endif /*MEDIA_CONTROL_SERVICE_H_*/
@@ -194,18 +194,21 @@ private:
   mediaMetaData objMetaData_;
   std::vector<mediaCoverArt> objCoverArt_;
   std::vector<std::string> enableActions_;
+  unsigned long version_;
 
 public:
   mediaSession() :
     playStatus_("PLAYSTATE_NONE"),
     muteStatus_("unmute"),
-    playPosition_("0.0"){}
+    playPosition_("0.0"),
+    version_(0){}
   mediaSession(const std::string& mediaId, const std::string& appId) :
     mediaId_(mediaId),
     appId_(appId),
     playStatus_("PLAYSTATE_NONE"),
     muteStatus_("unmute"),
-    playPosition_("0.0"){}
+    playPosition_("0.0"),
+    version_(0){}
 
   std::string getMediaId() const { return mediaId_; }
   std::string getAppId() const { return appId_; }
@@ -224,6 +227,8 @@ public:
 
   std::vector<std::string> getActionObj() const { return enableActions_; }
 
+  unsigned long getVersion() const { return version_; }
+
   void setMediaId(const std::string& mediaId) {
     mediaId_ = mediaId;
   }
@@ -256,6 +261,10 @@ public:
   void setAction(const std::vector<std::string>& enableActions) {
     enableActions_ = enableActions;
   }
+
+  void setVersion(const unsigned long& version) {
+    version_ = version;
+  }
 };
 
 struct BTDeviceInfo {
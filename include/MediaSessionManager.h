@@ -22,6 +22,7 @@
 ------------------------------------------------------------------------------*/
 #include <map>
 #include <vector>
+#include <memory>
 #include "MediaControlTypes.h"
 #include "RequestReceiver.h"
 #include <luna-service2/lunaservice.hpp>
@@ -36,6 +37,11 @@ private:
   RequestReceiver objRequestRcvr_;
   LSHandle *lshandle_ = nullptr;
   FileManager *fileManager;
+  unsigned long stateVersion_ = 0;
+  // the play position ticks constantly and no polled query returns it, so it
+  // keeps a counter of its own and leaves the session versions alone
+  unsigned long positionVersion_ = 0;
+  unsigned long updateStateVersion() { return ++stateVersion_; }
 
 public:
   static MediaSessionManager &getInstance();
@@ -44,6 +50,8 @@ public:
   int activateMediaSession (const std::string& mediaId);
   int deactivateMediaSession (const std::string& mediaId);
   int removeMediaSession (const std::string& mediaId);
+  std::vector<int> addMediaSessions (const std::vector<std::pair<std::string, std::string>>& sessions);
+  std::vector<int> removeMediaSessions (const std::vector<std::string>& mediaIds);
   int getMediaMetaData(const std::string& mediaId,
                        mediaMetaData& objMetaData);
   int getMediaCoverArt(const std::string& mediaId,
@@ -58,6 +66,8 @@ public:
                          std::string& muteStatus);
   int getMediaPlayPosition(const std::string& mediaId,
                            std::string& playPosition);
+  int getMediaSessionVersion(const std::string& mediaId,
+                             unsigned long& version);
   int setMediaMetaData(const std::string& mediaId,
                        const mediaMetaData& objMetaData);
   int setMediaCoverArt(const std::string& mediaId,
@@ -72,13 +82,29 @@ public:
                            const std::string& playPosition);
   std::vector<std::string> getMediaSessionList(const std::string& appId);
   std::vector<std::string> getActiveMediaSessionList();
+  std::vector<mediaSession> getMediaSessionSnapshot(const std::string& appId,
+                                                    const int& displayId,
+                                                    const size_t& offset,
+                                                    const size_t& limit,
+                                                    size_t& totalCount);
   std::string getCurrentActiveSession();
   bool validatePlayStatus(const std::string& playStatus);
   int getDisplayIdForMedia(const std::string& mediaId);
+  int getDisplayIdForApp(const std::string& appId);
   std::string getMediaIdFromDisplayId(const int& displayId);
-  int coverArtDownload(const std::string& mediaId, const std::vector<std::string> uri);
-  bool download(const std::string& uri);
+  void prefetchCoverArt(const std::string& mediaId);
+  void pinActiveCoverArt();
+  bool getCachedCoverArt(const std::string& uri, int displayId, FileManager::CachedCoverArt& paths);
+  //message is the subscribed request to answer, nullptr if nobody waits for the results
+  int coverArtDownload(const std::string& mediaId, int displayId, const std::vector<std::string> uri,
+                       LSMessage* message);
+  void onCoverArtDownloaded(const std::string& uri, int displayId, const std::shared_ptr<LSMessage>& requester,
+                            bool downloaded, const std::string& filePath);
+  void replyCoverArtPath(const std::shared_ptr<LSMessage>& requester, const std::string& uri, bool downloaded,
+                         const std::string& filePath, const std::string& scaledPath, const std::string& rawPath);
   void setLSHandle(LSHandle *lshandle) { lshandle_ = lshandle;};
+  unsigned long getStateVersion() const { return stateVersion_; }
+  unsigned long getPositionVersion() const { return positionVersion_; }
 };
 
 #endif /*MEDIA_SESSION_MANAGER_H_*/
@@ -22,6 +22,7 @@
 ------------------------------------------------------------------------------*/
 #include <map>
 #include <list>
+#include <set>
 
 #include "MediaControlTypes.h"
 
@@ -34,6 +35,7 @@ public:
   RequestReceiver();
   void addClient(const std::string& mediaId);
   void removeClient(const std::string& mediaId);
+  void removeClients(const std::set<std::string>& mediaIds);
   std::string getLastActiveClient();
   std::list<std::string> getClientList() const { return clientListInfo_; }
 };
@@ -24,9 +24,47 @@
 #include <fcntl.h>
 #include <cstring>
 #include <dirent.h>
-
-const short int MAX_TRY = 3;
+#include <glib.h>
+
+const short int MAX_TRY = 4;
+// retry backoff doubles from the base delay up to the max, each delay is jittered
+const unsigned int RETRY_BASE_DELAY_MS = 500;
+const unsigned int RETRY_MAX_DELAY_MS = 4000;
+// no retry is started past this point, counted from the first request
+const unsigned int DOWNLOAD_DEADLINE_MS = 30000;
 const std::string COVERART_FILE_PATH = "/media/internal/.media-session/";
+const size_t COVERART_CACHE_MAX_SIZE = 10 * 1024 * 1024; // 10MB
+// the cache filesystem is shared with user content, the cache shrinks rather than
+// leave less than this free there. checked every COVERART_DISK_CHECK_INTERVAL seconds
+const size_t COVERART_FREE_SPACE_FLOOR = 128 * 1024 * 1024; // 128MB
+const unsigned int COVERART_DISK_CHECK_INTERVAL = 60;
+// time from process start until the service is registered and idle, logged as an error when exceeded
+const unsigned int SERVICE_READY_BUDGET_MS = 500;
+// freshness for cover art that has validators but no Cache-Control lifetime
+const long COVERART_DEFAULT_FRESHNESS = 24 * 60 * 60;
+const size_t MAX_ACTIVE_DOWNLOADS = 8;
+const size_t DOWNLOAD_QUEUE_LIMIT = 32;
+// downloads are gathered in memory and written out in chunks of this size
+const size_t DOWNLOAD_WRITE_BUFFER_SIZE = 256 * 1024;
+// a single cover art larger than this is aborted instead of filling the cache
+const long long COVERART_MAX_DOWNLOAD_SIZE = 8 * 1024 * 1024; // 8MB
+const long DOWNLOAD_CONNECT_TIMEOUT_MS = 10000;
+const long DOWNLOAD_TIMEOUT_MS = 20000;
+// a transfer slower than this many bytes per second for the given time is aborted
+const long DOWNLOAD_LOW_SPEED_LIMIT = 1024;
+const long DOWNLOAD_LOW_SPEED_TIME = 10;
+const size_t MAX_IDLE_CURL_HANDLES = MAX_ACTIVE_DOWNLOADS;
+// longest edge cover art is shown with on each display, indexed by display id.
+// replies carry a variant scaled to fit it
+const int COVERART_DISPLAY_EDGES[] = {480, 480};
+const int COVERART_RESIZE_THREADS = 2;
+// file:// and data: cover art is read and stored on these threads
+const int COVERART_LOCAL_THREADS = 2;
+// file:// cover art is only taken from below these directories
+const char* const COVERART_LOCAL_ROOTS[] = {"/media/internal/", "/media/cryptofs/apps/", "/usr/palm/applications/"};
+// start cover art downloads for the active session from setMediaCoverArt,
+// without waiting for a ui to ask for them
+const bool COVERART_PREFETCH = true;
 
 static bool directoryExists(const std::string& path) {
 
@@ -68,18 +106,28 @@ static bool deleteAllFilesInDirectory(const std::string& path) {
   return true;
 }
 
-static int computeHashKey(const std::string& str) {
-    std::hash<std::string> hasher;
-    size_t hashValue = hasher(str); // Compute hash value
-
-    // Convert hash value to a 3-digit number
-    int hashKey = hashValue % 1000; // Ensure it's within 0 to 999
+static std::string computeHashKey(const std::string& str) {
+    // 128 bits of sha256, wide enough that two urls never share a file name
+    gchar* digest = g_compute_checksum_for_string(G_CHECKSUM_SHA256, str.c_str(), str.size());
+    std::string hashKey = std::string(digest).substr(0, 32);
+    g_free(digest);
 
     return hashKey;
 }
 
 static std::string extractFilenameFromUrl(const std::string& url) {
-    int hashValue = computeHashKey(url);
+    std::string hashValue = computeHashKey(url);
+    // data: uris have no name, only a media type like image/png
+    if (url.compare(0, 5, "data:") == 0) {
+        size_t end = url.find_first_of(";,", 5);
+        size_t slash = url.find('/', 5);
+        std::string subtype = (slash != std::string::npos && slash < end) ? url.substr(slash + 1, end - slash - 1) : "";
+        if (subtype == "jpeg")
+            subtype = "jpg";
+        if (subtype.empty() || subtype.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789+-") != std::string::npos)
+            return "data_" + hashValue;
+        return "data_" + hashValue + "." + subtype;
+    }
     // Find the position of the query string
     size_t query_pos = url.find('?');
     std::string clean_url = url.substr(0, query_pos);
@@ -95,10 +143,10 @@ static std::string extractFilenameFromUrl(const std::string& url) {
             std::string name = fileName.substr(0,dot_pos);
             std::string fileType = fileName.substr(dot_pos);
             //create new file name with hashValue
-            newFileName = name + "_" + std::to_string(hashValue) + fileType;
+            newFileName = name + "_" + hashValue + fileType;
             return newFileName;
         }
-        return fileName;
+        return fileName + "_" + hashValue;
     }
     // Fallback to a default name if no '/' is found
     return "";
@@ -68,3 +68,9 @@ std::string createJsonReplyString(bool returnValue,
 
   return responseObj.stringify();
 }
+
+bool hasSubscribers(LSHandle *lsHandle, const char *key) {
+  if (!lsHandle)
+    return false;
+  return LSSubscriptionGetHandleSubscribersCount(lsHandle, key) > 0;
+}
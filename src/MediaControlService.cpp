@@ -23,6 +23,8 @@
 
 #include <string>
 #include <iostream>
+#include <algorithm>
+#include <set>
 #include "Utils.h"
 
 const std::string cstrMediaControlService = "com.webos.service.mediacontroller";
@@ -38,6 +40,102 @@ const std::string MEDIA_SESSION_FOLDER = "/media/internal/.media-session";
 bool BTConnected_ = false;
 
 const short dispId = 0;
+const int MAX_SNAPSHOT_PAGE_SIZE = 100;
+const std::vector<std::string> SNAPSHOT_FIELDS = {"metaData", "playStatus", "muteStatus",
+                                                  "playPosition", "coverArt", "supportedActions"};
+// taken during static initialization, as close to process start as it gets
+static const gint64 processStartTime = g_get_monotonic_time();
+
+// first default idle dispatch, by then the methods are registered and whatever
+// was queued at startup, like the bluetooth2 status replies, has been handled
+static gboolean onServiceReady(gpointer data) {
+  long long readyMs = (g_get_monotonic_time() - processStartTime) / 1000;
+  if (readyMs > SERVICE_READY_BUDGET_MS)
+    PMLOG_ERROR(CONST_MODULE_MCS, "%s ready after %lld ms, budget %u ms", __FUNCTION__, readyMs,
+                SERVICE_READY_BUDGET_MS);
+  else
+    PMLOG_INFO(CONST_MODULE_MCS, "%s ready after %lld ms", __FUNCTION__, readyMs);
+  return G_SOURCE_REMOVE;
+}
+
+// ifNoneMatch carries the session version last seen by a poller
+static bool isNotModified(const pbnjson::JValue &payload, const unsigned long &version) {
+  return payload.hasKey("ifNoneMatch")
+         && payload["ifNoneMatch"].asNumber<int64_t>() == static_cast<int64_t>(version);
+}
+
+static std::string quoteJsonString(const std::string &value) {
+  std::string quoted = "\"";
+  for (unsigned char c : value) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+      quoted += c;
+    } else if (c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      quoted += escaped;
+    } else {
+      quoted += c;
+    }
+  }
+  return quoted + "\"";
+}
+
+static std::string createNotModifiedReplyString(const unsigned long &version) {
+  pbnjson::JObject responseObj;
+  responseObj.put("returnValue", true);
+  responseObj.put("notModified", true);
+  responseObj.put("version", static_cast<int64_t>(version));
+  return responseObj.stringify();
+}
+
+static pbnjson::JObject createMetaDataObject(const mediaMetaData &objMetaData) {
+  pbnjson::JObject metaDataObj;
+  metaDataObj.put("title", objMetaData.getTitle());
+  metaDataObj.put("artist", objMetaData.getArtist());
+  metaDataObj.put("totalDuration", objMetaData.getDuration());
+  metaDataObj.put("album", objMetaData.getAlbum());
+  metaDataObj.put("genre", objMetaData.getGenre());
+  metaDataObj.put("trackNumber", objMetaData.getTrackNumber());
+  metaDataObj.put("volume", objMetaData.getVolume());
+  return metaDataObj;
+}
+
+static pbnjson::JValue createCoverArtArray(const std::vector<mediaCoverArt> &objCoverArt) {
+  pbnjson::JValue coverArtArray = pbnjson::Array();
+  for (auto &element : objCoverArt) {
+    pbnjson::JValue coverArtItem = pbnjson::Object();
+
+    coverArtItem.put("src", element.getSource());
+    coverArtItem.put("type", element.getType());
+
+    std::vector<coverArtSize> sizes = element.getSize();
+
+    pbnjson::JValue coverArtSizes = pbnjson::Array();
+    for(auto &size : sizes) {
+      pbnjson::JValue sizesObj = pbnjson::Object();
+
+      sizesObj.put("width", size.width);
+      sizesObj.put("height", size.height);
+      coverArtSizes.append(sizesObj);
+    }
+    coverArtItem.put("sizes", coverArtSizes);
+    coverArtArray.append(coverArtItem);
+  }
+  return coverArtArray;
+}
+
+// per session result entry for the batch register/unregister replies
+static pbnjson::JObject createSessionResultObject(const std::string &mediaId, const int &errorCode) {
+  pbnjson::JObject resultObj;
+  resultObj.put("mediaId", mediaId);
+  resultObj.put("returnValue", MCS_ERROR_NO_ERROR == errorCode);
+  if (MCS_ERROR_NO_ERROR != errorCode) {
+    resultObj.put("errorCode", errorCode);
+    resultObj.put("errorText", getErrorTextFromErrorCode(errorCode));
+  }
+  return resultObj;
+}
 
 static void sendErrorResponse(int &errorCode, LS::Message &msgRequest) {
   PMLOG_ERROR(CONST_MODULE_MCS, "API fails with error %s", getErrorTextFromErrorCode(errorCode).c_str());
@@ -54,6 +152,8 @@ MediaControlService::MediaControlService()
   LS_CATEGORY_BEGIN(MediaControlService, "/")
   LS_CATEGORY_METHOD(registerMediaSession)
   LS_CATEGORY_METHOD(unregisterMediaSession)
+  LS_CATEGORY_METHOD(registerMediaSessions)
+  LS_CATEGORY_METHOD(unregisterMediaSessions)
   LS_CATEGORY_METHOD(activateMediaSession)
   LS_CATEGORY_METHOD(deactivateMediaSession)
   LS_CATEGORY_METHOD(getMediaMetaData)
@@ -61,6 +161,7 @@ MediaControlService::MediaControlService()
   LS_CATEGORY_METHOD(getMediaSessionInfo)
   LS_CATEGORY_METHOD(getMediaSessionId)
   LS_CATEGORY_METHOD(getActiveMediaSessions)
+  LS_CATEGORY_METHOD(getMediaSessionSnapshot)
   LS_CATEGORY_METHOD(getMediaCoverArtPath)
   LS_CATEGORY_METHOD(setMediaMetaData)
   LS_CATEGORY_METHOD(setMediaPlayStatus)
@@ -85,20 +186,17 @@ MediaControlService::MediaControlService()
                                    payload.stringify().c_str(),
                                    &MediaControlService::onBTServerStatusCb, this);
 
+  //cached cover art is kept across restarts, the cache index is loaded and
+  //reconciled against the folder by a background task once the loop is idle
   int rev = directoryExists(MEDIA_SESSION_FOLDER);
   if(!rev) {
     // Create the directory with 755 permissions
     if (mkdir(MEDIA_SESSION_FOLDER.c_str(), 0755) == -1) {
       PMLOG_ERROR(CONST_MODULE_MCS,"%s failed to create %s", __FUNCTION__, MEDIA_SESSION_FOLDER.c_str());
     }
-  } else {
-    if (deleteAllFilesInDirectory(MEDIA_SESSION_FOLDER)) {
-      PMLOG_INFO(CONST_MODULE_MCS,"%s All files deleted successfully.", __FUNCTION__);
-    } else {
-      PMLOG_INFO(CONST_MODULE_MCS,"%s Failed to delete all files.", __FUNCTION__);
-    }
   }
 
+  g_idle_add(onServiceReady, nullptr);
   // run the gmainloop
   g_main_loop_run(main_loop_ptr_.get());
 }
@@ -501,6 +599,152 @@ bool MediaControlService::unregisterMediaSession(LSMessage& message) {
   return true;
 }
 
+bool MediaControlService::registerMediaSessions(LSMessage& message) {
+  PMLOG_INFO(CONST_MODULE_MCS, "%s IN", __FUNCTION__);
+
+  LSMessageJsonParser msg(&message,STRICT_SCHEMA(PROPS_2(REQUIRED(sessions, array), \
+  REQUIRED(subscribe, boolean)) REQUIRED_2(sessions, subscribe)));
+
+  LS::Message request(&message);
+  int errorCode = MCS_ERROR_NO_ERROR;
+  if (!msg.parse(__FUNCTION__)) {
+    errorCode = MCS_ERROR_PARSING_FAILED;
+    sendErrorResponse(errorCode, request);
+    return true;
+  }
+
+  pbnjson::JValue payload = msg.get();
+  bool subscribed = payload["subscribe"].asBool();
+  pbnjson::JValue sessionList = payload["sessions"];
+  if (sessionList.arraySize() <= 0) {
+    errorCode = MCS_ERROR_PARSING_FAILED;
+    sendErrorResponse(errorCode, request);
+    return true;
+  }
+
+  std::vector<std::pair<std::string, std::string>> sessions;
+  sessions.reserve(sessionList.arraySize());
+  for (int i = 0; i < sessionList.arraySize(); i++) {
+    pbnjson::JValue session = sessionList[i];
+    if (!session["mediaId"].isString() || !session["appId"].isString()) {
+      errorCode = MCS_ERROR_PARSING_FAILED;
+      sendErrorResponse(errorCode, request);
+      return true;
+    }
+    sessions.emplace_back(session["mediaId"].asString(), session["appId"].asString());
+  }
+  PMLOG_INFO(CONST_MODULE_MCS, "%s count : %zu subscribed : %d", __FUNCTION__, sessions.size(), subscribed);
+
+  //key events for all sessions of this client are delivered through one subscription
+  if (LSMessageIsSubscription(&message)) {
+    CLSError lserror;
+    if (!LSSubscriptionAdd(lsHandle_, "registerMediaSession", &message, &lserror)) {
+      PMLOG_ERROR(CONST_MODULE_MCS, "%s LSSubscriptionAdd failed ",__FUNCTION__);
+      errorCode = MCS_ERROR_REGISTERSESSION_FAILED;
+      sendErrorResponse(errorCode, request);
+      return true;
+    }
+  }
+
+  if (ptrMediaSessionMgr_ == nullptr) {
+    errorCode = MCS_ERROR_REGISTERSESSION_FAILED;
+    sendErrorResponse(errorCode, request);
+    return true;
+  }
+
+  std::vector<int> result = ptrMediaSessionMgr_->addMediaSessions(sessions);
+
+  bool returnValue = false;
+  pbnjson::JValue resultArray = pbnjson::Array();
+  for (size_t i = 0; i < sessions.size(); i++) {
+    if (MCS_ERROR_NO_ERROR == result[i])
+      returnValue = true;
+    else
+      errorCode = result[i];
+    resultArray.append(createSessionResultObject(sessions[i].first, result[i]));
+  }
+
+  pbnjson::JObject responseObj;
+  responseObj.put("subscribed", subscribed);
+  responseObj.put("returnValue", returnValue);
+  if (!returnValue) {
+    responseObj.put("errorCode", errorCode);
+    responseObj.put("errorText", getErrorTextFromErrorCode(errorCode));
+  }
+  responseObj.put("results", resultArray);
+
+  std::string response = responseObj.stringify();
+  PMLOG_INFO(CONST_MODULE_MCS, "%s response : %s", __FUNCTION__, response.c_str());
+  request.respond(response.c_str());
+
+  return true;
+}
+
+bool MediaControlService::unregisterMediaSessions(LSMessage& message) {
+  PMLOG_INFO(CONST_MODULE_MCS, "%s IN", __FUNCTION__);
+
+  LSMessageJsonParser msg(&message,STRICT_SCHEMA(PROPS_1(REQUIRED(mediaIds, array)) REQUIRED_1(mediaIds)));
+
+  LS::Message request(&message);
+  int errorCode = MCS_ERROR_NO_ERROR;
+  if (!msg.parse(__FUNCTION__)) {
+    errorCode = MCS_ERROR_PARSING_FAILED;
+    sendErrorResponse(errorCode, request);
+    return true;
+  }
+
+  pbnjson::JValue mediaIdList = msg.get()["mediaIds"];
+  if (mediaIdList.arraySize() <= 0) {
+    errorCode = MCS_ERROR_PARSING_FAILED;
+    sendErrorResponse(errorCode, request);
+    return true;
+  }
+
+  std::vector<std::string> mediaIds;
+  mediaIds.reserve(mediaIdList.arraySize());
+  for (int i = 0; i < mediaIdList.arraySize(); i++) {
+    if (!mediaIdList[i].isString()) {
+      errorCode = MCS_ERROR_PARSING_FAILED;
+      sendErrorResponse(errorCode, request);
+      return true;
+    }
+    mediaIds.push_back(mediaIdList[i].asString());
+  }
+  PMLOG_INFO(CONST_MODULE_MCS, "%s count : %zu", __FUNCTION__, mediaIds.size());
+
+  if (ptrMediaSessionMgr_ == nullptr) {
+    errorCode = MCS_ERROR_INVALID_MEDIAID;
+    sendErrorResponse(errorCode, request);
+    return true;
+  }
+
+  std::vector<int> result = ptrMediaSessionMgr_->removeMediaSessions(mediaIds);
+
+  bool returnValue = false;
+  pbnjson::JValue resultArray = pbnjson::Array();
+  for (size_t i = 0; i < mediaIds.size(); i++) {
+    if (MCS_ERROR_NO_ERROR == result[i])
+      returnValue = true;
+    else
+      errorCode = result[i];
+    resultArray.append(createSessionResultObject(mediaIds[i], result[i]));
+  }
+
+  pbnjson::JObject responseObj;
+  responseObj.put("returnValue", returnValue);
+  if (!returnValue) {
+    responseObj.put("errorCode", errorCode);
+    responseObj.put("errorText", getErrorTextFromErrorCode(errorCode));
+  }
+  responseObj.put("results", resultArray);
+
+  std::string response = responseObj.stringify();
+  PMLOG_INFO(CONST_MODULE_MCS, "%s response : %s", __FUNCTION__, response.c_str());
+  request.respond(response.c_str());
+
+  return true;
+}
+
 bool MediaControlService::activateMediaSession(LSMessage& message) {
   PMLOG_INFO(CONST_MODULE_MCS, "%s IN", __FUNCTION__);
 
@@ -580,7 +824,8 @@ bool MediaControlService::deactivateMediaSession(LSMessage& message) {
 bool MediaControlService::getMediaMetaData(LSMessage& message) {
   PMLOG_INFO(CONST_MODULE_MCS, "%s IN", __FUNCTION__);
 
-  LSMessageJsonParser msg(&message,STRICT_SCHEMA(PROPS_1(REQUIRED(mediaId, string)) REQUIRED_1(mediaId)));
+  LSMessageJsonParser msg(&message,STRICT_SCHEMA(PROPS_2(REQUIRED(mediaId, string), \
+  OPTIONAL(ifNoneMatch, integer)) REQUIRED_1(mediaId)));
 
   LS::Message request(&message);
   int errorCode = MCS_ERROR_NO_ERROR;
@@ -599,23 +844,28 @@ bool MediaControlService::getMediaMetaData(LSMessage& message) {
   msg.get("mediaId", mediaId);
   PMLOG_INFO(CONST_MODULE_MCS, "%s mediaId : %s", __FUNCTION__, mediaId.c_str());
 
+  unsigned long version = 0;
+  if(ptrMediaSessionMgr_)
+    errorCode = ptrMediaSessionMgr_->getMediaSessionVersion(mediaId, version);
+
+  if(MCS_ERROR_NO_ERROR == errorCode && isNotModified(msg.get(), version)) {
+    response = createNotModifiedReplyString(version);
+    PMLOG_INFO(CONST_MODULE_MCS, "%s response : %s", __FUNCTION__, response.c_str());
+    request.respond(response.c_str());
+    return true;
+  }
+
   mediaMetaData objMetaData;
   if(ptrMediaSessionMgr_)
     errorCode = ptrMediaSessionMgr_->getMediaMetaData(mediaId, objMetaData);
 
   if(MCS_ERROR_NO_ERROR == errorCode) {
-    pbnjson::JObject metaDataObj;
-    metaDataObj.put("title", objMetaData.getTitle());
-    metaDataObj.put("artist", objMetaData.getArtist());
-    metaDataObj.put("totalDuration", objMetaData.getDuration());
-    metaDataObj.put("album", objMetaData.getAlbum());
-    metaDataObj.put("genre", objMetaData.getGenre());
-    metaDataObj.put("trackNumber", objMetaData.getTrackNumber());
-    metaDataObj.put("volume", objMetaData.getVolume());
+    pbnjson::JObject metaDataObj = createMetaDataObject(objMetaData);
 
     pbnjson::JObject responseObj;
     responseObj.put("returnValue", true);
     responseObj.put("metaData", metaDataObj);
+    responseObj.put("version", static_cast<int64_t>(version));
     response = responseObj.stringify();
   }
   else {
@@ -677,7 +927,7 @@ bool MediaControlService::setSupportedActions(LSMessage& message) {
     return true;
   }
 
-  if (ptrMediaControlPrivate_->enableMediaAction_) {
+  if (ptrMediaControlPrivate_->enableMediaAction_ && hasSubscribers(lsHandle_, "receiveMediaPlaybackInfo")) {
     // Create response to share cover art details to subscribed client
     pbnjson::JValue responsePayload = pbnjson::Object();
     responsePayload.put("displayId", dispId);
@@ -695,10 +945,11 @@ bool MediaControlService::setSupportedActions(LSMessage& message) {
     responsePayload.put("supportedActions", actions);
     responsePayload.put("returnValue", true);
 
-    PMLOG_INFO(CONST_MODULE_MCS, "%s send subscription response :%s", __FUNCTION__, responsePayload.stringify().c_str());
+    std::string subscriptionResponse = responsePayload.stringify();
+    PMLOG_INFO(CONST_MODULE_MCS, "%s send subscription response :%s", __FUNCTION__, subscriptionResponse.c_str());
     /*Reply coverArt details to receiveMediaPlaybackInfo*/
     CLSError lserror;
-    if (!LSSubscriptionReply(lsHandle_, "receiveMediaPlaybackInfo", responsePayload.stringify().c_str(), &lserror)) {
+    if (!LSSubscriptionReply(lsHandle_, "receiveMediaPlaybackInfo", subscriptionResponse.c_str(), &lserror)) {
       errorCode = MCS_ERROR_SUBSCRIPTION_REPLY_FAILED;
       sendErrorResponse(errorCode, request);
       return true;
@@ -714,7 +965,8 @@ bool MediaControlService::setSupportedActions(LSMessage& message) {
 bool MediaControlService::getMediaPlayStatus(LSMessage& message) {
   PMLOG_INFO(CONST_MODULE_MCS, "%s IN", __FUNCTION__);
 
-  LSMessageJsonParser msg(&message,STRICT_SCHEMA(PROPS_1(REQUIRED(mediaId, string)) REQUIRED_1(mediaId)));
+  LSMessageJsonParser msg(&message,STRICT_SCHEMA(PROPS_2(REQUIRED(mediaId, string), \
+  OPTIONAL(ifNoneMatch, integer)) REQUIRED_1(mediaId)));
 
   LS::Message request(&message);
   int errorCode = MCS_ERROR_NO_ERROR;
@@ -733,6 +985,17 @@ bool MediaControlService::getMediaPlayStatus(LSMessage& message) {
   msg.get("mediaId", mediaId);
   PMLOG_INFO(CONST_MODULE_MCS, "%s mediaId : %s", __FUNCTION__, mediaId.c_str());
 
+  unsigned long version = 0;
+  if(ptrMediaSessionMgr_)
+    errorCode = ptrMediaSessionMgr_->getMediaSessionVersion(mediaId, version);
+
+  if(MCS_ERROR_NO_ERROR == errorCode && isNotModified(msg.get(), version)) {
+    response = createNotModifiedReplyString(version);
+    PMLOG_INFO(CONST_MODULE_MCS, "%s response : %s", __FUNCTION__, response.c_str());
+    request.respond(response.c_str());
+    return true;
+  }
+
   std::string playStatus;
   if(ptrMediaSessionMgr_)
     errorCode = ptrMediaSessionMgr_->getMediaPlayStatus(mediaId, playStatus);
@@ -741,6 +1004,7 @@ bool MediaControlService::getMediaPlayStatus(LSMessage& message) {
     pbnjson::JObject responseObj;
     responseObj.put("returnValue", true);
     responseObj.put("playStatus", playStatus);
+    responseObj.put("version", static_cast<int64_t>(version));
     response = responseObj.stringify();
   }
   else {
@@ -757,7 +1021,8 @@ bool MediaControlService::getMediaPlayStatus(LSMessage& message) {
 bool MediaControlService::getMediaSessionInfo(LSMessage& message) {
   PMLOG_INFO(CONST_MODULE_MCS, "%s IN", __FUNCTION__);
 
-  LSMessageJsonParser msg(&message,STRICT_SCHEMA(PROPS_1(REQUIRED(mediaId, string)) REQUIRED_1(mediaId)));
+  LSMessageJsonParser msg(&message,STRICT_SCHEMA(PROPS_2(REQUIRED(mediaId, string), \
+  OPTIONAL(ifNoneMatch, integer)) REQUIRED_1(mediaId)));
 
   LS::Message request(&message);
   int errorCode = MCS_ERROR_NO_ERROR;
@@ -776,20 +1041,24 @@ bool MediaControlService::getMediaSessionInfo(LSMessage& message) {
   msg.get("mediaId", mediaId);
   PMLOG_INFO(CONST_MODULE_MCS, "%s mediaId : %s", __FUNCTION__, mediaId.c_str());
 
+  unsigned long version = 0;
+  if(ptrMediaSessionMgr_)
+    errorCode = ptrMediaSessionMgr_->getMediaSessionVersion(mediaId, version);
+
+  if(MCS_ERROR_NO_ERROR == errorCode && isNotModified(msg.get(), version)) {
+    response = createNotModifiedReplyString(version);
+    PMLOG_INFO(CONST_MODULE_MCS, "%s response : %s", __FUNCTION__, response.c_str());
+    request.respond(response.c_str());
+    return true;
+  }
+
   mediaSession objMediaSession;
   if(ptrMediaSessionMgr_)
     errorCode = ptrMediaSessionMgr_->getMediaSessionInfo(mediaId, objMediaSession);
 
   if(MCS_ERROR_NO_ERROR == errorCode) {
     mediaMetaData objMetaData = objMediaSession.getMediaMetaDataObj();
-    pbnjson::JObject metaDataObj;
-    metaDataObj.put("title", objMetaData.getTitle());
-    metaDataObj.put("artist", objMetaData.getArtist());
-    metaDataObj.put("totalDuration", objMetaData.getDuration());
-    metaDataObj.put("album", objMetaData.getAlbum());
-    metaDataObj.put("genre", objMetaData.getGenre());
-    metaDataObj.put("trackNumber", objMetaData.getTrackNumber());
-    metaDataObj.put("volume", objMetaData.getVolume());
+    pbnjson::JObject metaDataObj = createMetaDataObject(objMetaData);
 
     pbnjson::JObject sessionInfoObj;
     sessionInfoObj.put("mediaId", objMediaSession.getMediaId());
@@ -799,6 +1068,7 @@ bool MediaControlService::getMediaSessionInfo(LSMessage& message) {
     pbnjson::JObject responseObj;
     responseObj.put("returnValue", true);
     responseObj.put("sessionInfo", sessionInfoObj);
+    responseObj.put("version", static_cast<int64_t>(version));
     response = responseObj.stringify();
   }
   else {
@@ -905,6 +1175,111 @@ bool MediaControlService::getActiveMediaSessions(LSMessage& message) {
   return true;
 }
 
+bool MediaControlService::getMediaSessionSnapshot(LSMessage& message) {
+  PMLOG_INFO(CONST_MODULE_MCS, "%s IN", __FUNCTION__);
+
+  LSMessageJsonParser msg(&message,STRICT_SCHEMA(PROPS_5(OPTIONAL(appId, string), \
+  OPTIONAL(displayId, integer),OPTIONAL(fields, array),OPTIONAL(offset, integer), \
+  OPTIONAL(limit, integer))));
+
+  LS::Message request(&message);
+  int errorCode = MCS_ERROR_NO_ERROR;
+
+  if (!msg.parse(__FUNCTION__)) {
+    errorCode = MCS_ERROR_PARSING_FAILED;
+    sendErrorResponse(errorCode, request);
+    return true;
+  }
+
+  pbnjson::JValue payload = msg.get();
+  std::string appId = payload["appId"].asString();
+  int displayId = payload.hasKey("displayId") ? payload["displayId"].asNumber<int>() : -1;
+  int offset = payload.hasKey("offset") ? payload["offset"].asNumber<int>() : 0;
+  int limit = payload.hasKey("limit") ? payload["limit"].asNumber<int>() : MAX_SNAPSHOT_PAGE_SIZE;
+  if (offset < 0 || limit <= 0) {
+    errorCode = MCS_ERROR_PARSING_FAILED;
+    sendErrorResponse(errorCode, request);
+    return true;
+  }
+  limit = std::min(limit, MAX_SNAPSHOT_PAGE_SIZE);
+#if !defined(FEATURE_DUAL_DISPLAY)
+  if (displayId > 0)
+    displayId = 0;
+#endif
+
+  //all fields are returned unless the caller selects some
+  std::set<std::string> fields(SNAPSHOT_FIELDS.begin(), SNAPSHOT_FIELDS.end());
+  if (payload.hasKey("fields")) {
+    pbnjson::JValue fieldList = payload["fields"];
+    fields.clear();
+    for (int i = 0; i < fieldList.arraySize(); i++) {
+      std::string field = fieldList[i].isString() ? fieldList[i].asString() : CSTR_EMPTY;
+      if (std::find(SNAPSHOT_FIELDS.begin(), SNAPSHOT_FIELDS.end(), field) == SNAPSHOT_FIELDS.end()) {
+        PMLOG_ERROR(CONST_MODULE_MCS, "%s unknown field : %s", __FUNCTION__, field.c_str());
+        errorCode = MCS_ERROR_PARSING_FAILED;
+        sendErrorResponse(errorCode, request);
+        return true;
+      }
+      fields.insert(field);
+    }
+  }
+
+  if (ptrMediaSessionMgr_ == nullptr) {
+    errorCode = MCS_ERROR_NO_ACTIVE_SESSION;
+    sendErrorResponse(errorCode, request);
+    return true;
+  }
+
+  PMLOG_INFO(CONST_MODULE_MCS, "%s appId : %s displayId : %d offset : %d limit : %d",
+                                __FUNCTION__, appId.c_str(), displayId, offset, limit);
+
+  size_t totalCount = 0;
+  std::vector<mediaSession> mediaSessions = ptrMediaSessionMgr_->getMediaSessionSnapshot(appId,
+                                              displayId, offset, limit, totalCount);
+  std::vector<std::string> activeList = ptrMediaSessionMgr_->getActiveMediaSessionList();
+  std::set<std::string> activeSessions(activeList.begin(), activeList.end());
+
+  pbnjson::JValue sessionArray = pbnjson::Array();
+  for (const auto& objMediaSession : mediaSessions) {
+    pbnjson::JObject sessionObj;
+    sessionObj.put("mediaId", objMediaSession.getMediaId());
+    sessionObj.put("appId", objMediaSession.getAppId());
+    sessionObj.put("displayId", ptrMediaSessionMgr_->getDisplayIdForApp(objMediaSession.getAppId()));
+    sessionObj.put("active", activeSessions.count(objMediaSession.getMediaId()) > 0);
+    sessionObj.put("version", static_cast<int64_t>(objMediaSession.getVersion()));
+    if (fields.count("metaData"))
+      sessionObj.put("metaData", createMetaDataObject(objMediaSession.getMediaMetaDataObj()));
+    if (fields.count("playStatus"))
+      sessionObj.put("playStatus", objMediaSession.getPlayStatus());
+    if (fields.count("muteStatus"))
+      sessionObj.put("muteStatus", objMediaSession.getMuteStatus());
+    if (fields.count("playPosition"))
+      sessionObj.put("playPosition", objMediaSession.getPlayposition());
+    if (fields.count("coverArt"))
+      sessionObj.put("coverArt", createCoverArtArray(objMediaSession.getMediaCoverArtObj()));
+    if (fields.count("supportedActions")) {
+      pbnjson::JValue actionListArray = pbnjson::Array();
+      for (const auto& action : objMediaSession.getActionObj())
+        actionListArray.append(action);
+      sessionObj.put("supportedActions", actionListArray);
+    }
+    sessionArray.append(sessionObj);
+  }
+
+  pbnjson::JObject responseObj;
+  responseObj.put("returnValue", true);
+  responseObj.put("sessions", sessionArray);
+  responseObj.put("totalCount", static_cast<int64_t>(totalCount));
+  if (offset + mediaSessions.size() < totalCount)
+    responseObj.put("nextOffset", static_cast<int64_t>(offset + mediaSessions.size()));
+
+  std::string response = responseObj.stringify();
+  PMLOG_INFO(CONST_MODULE_MCS, "%s response : %s", __FUNCTION__, response.c_str());
+  request.respond(response.c_str());
+
+  return true;
+}
+
 bool MediaControlService::getMediaCoverArtPath(LSMessage& message) {
   PMLOG_INFO(CONST_MODULE_MCS, "%s IN", __FUNCTION__);
 
@@ -972,34 +1347,41 @@ bool MediaControlService::getMediaCoverArtPath(LSMessage& message) {
     }
   }
 
-  std::string target = "";
-
   std::string mediaId = ptrMediaSessionMgr_->getMediaIdFromDisplayId(displayId);
 
+  //cached art is answered right here, only misses are downloaded and
+  //come back later over the subscription
+  pbnjson::JValue coverArtArray = pbnjson::Array();
+  std::vector<std::string> misses;
+  for (const auto& source : sources) {
+    pbnjson::JValue coverArtSrcInfo = pbnjson::Object();
+    coverArtSrcInfo.put("src", source);
+    FileManager::CachedCoverArt paths;
+    bool cached = ptrMediaSessionMgr_->getCachedCoverArt(source, displayId, paths);
+    coverArtSrcInfo.put("cached", cached);
+    if (cached) {
+      coverArtSrcInfo.put("srcPath", paths.filePath);
+      coverArtSrcInfo.put("scaledPath", paths.scaledPath);
+      if (!paths.rawPath.empty())
+        coverArtSrcInfo.put("rawPath", paths.rawPath);
+    } else {
+      misses.push_back(source);
+    }
+    coverArtArray.append(coverArtSrcInfo);
+  }
+
   ptrMediaSessionMgr_->setLSHandle(lsHandle_);
-  errorCode = MCS_ERROR_NO_ERROR;
-  errorCode = ptrMediaSessionMgr_->coverArtDownload(mediaId, std::move(sources));
+  errorCode = ptrMediaSessionMgr_->coverArtDownload(mediaId, displayId, std::move(misses),
+                                                    LSMessageIsSubscription(&message) ? &message : nullptr);
 
   if(errorCode != MCS_ERROR_NO_ERROR)
   {
-    pbnjson::JObject responseObj;
     errorText = CSTR_NO_ACTIVE_SESSION;
     response = createJsonReplyString(false, errorCode, errorText);
     request.respond(response.c_str());
     return false;
   }
 
-  pbnjson::JValue coverArtArray = pbnjson::Array();
-  for(int i = 0; i < srcs.arraySize(); i++) {
-    pbnjson::JValue coverArtSrcInfo = pbnjson::Object();
-    coverArtSrcInfo.put("src", srcs[i].asString());
-
-    std::string targetPath = COVERART_FILE_PATH + extractFilenameFromUrl(srcs[i].asString());
-    PMLOG_INFO(CONST_MODULE_MCS, "tagetPath : %s", targetPath.c_str());
-    coverArtSrcInfo.put("srcPath", targetPath);
-    coverArtArray.append(coverArtSrcInfo);
-  }
-
   pbnjson::JObject responseObj;
   responseObj.put("coverArtPathInfo", coverArtArray);
   responseObj.put("subscribed", subscribed);
@@ -1060,7 +1442,7 @@ bool MediaControlService::setMediaMetaData(LSMessage& message) {
     return true;
   }
 
-  if (ptrMediaControlPrivate_->mediaMetaData_) {
+  if (ptrMediaControlPrivate_->mediaMetaData_ && hasSubscribers(lsHandle_, "receiveMediaPlaybackInfo")) {
     /*Get display ID from media ID*/
     int displayId = ptrMediaSessionMgr_->getDisplayIdForMedia(mediaId);
     //ToDo : Below platform check to be removed once dual blueetooth support in OSE
@@ -1086,10 +1468,11 @@ bool MediaControlService::setMediaMetaData(LSMessage& message) {
 
     responsePayload.put("returnValue", true);
     responsePayload.put("subscribed", true);
-    PMLOG_INFO(CONST_MODULE_MCS, "%s send subscription response :%s", __FUNCTION__, responsePayload.stringify().c_str());
+    std::string subscriptionResponse = responsePayload.stringify();
+    PMLOG_INFO(CONST_MODULE_MCS, "%s send subscription response :%s", __FUNCTION__, subscriptionResponse.c_str());
     /*Add subscription for receiveMediaPlaybackInfo*/
     CLSError lserror;
-    if (!LSSubscriptionReply(lsHandle_,"receiveMediaPlaybackInfo" , responsePayload.stringify().c_str(), &lserror)){
+    if (!LSSubscriptionReply(lsHandle_,"receiveMediaPlaybackInfo" , subscriptionResponse.c_str(), &lserror)){
       errorCode = MCS_ERROR_SUBSCRIPTION_REPLY_FAILED;
       sendErrorResponse(errorCode, request);
       return true;
@@ -1190,7 +1573,7 @@ bool MediaControlService::setMediaPlayStatus(LSMessage& message) {
     }
   }
 
-  if (ptrMediaControlPrivate_->playStatus_) {
+  if (ptrMediaControlPrivate_->playStatus_ && hasSubscribers(lsHandle_, "receiveMediaPlaybackInfo")) {
     /*Get display ID from media ID*/
     int displayId = ptrMediaSessionMgr_->getDisplayIdForMedia(mediaId);
     //ToDo : Below platform check to be removed once dual blueetooth support in OSE
@@ -1213,10 +1596,11 @@ bool MediaControlService::setMediaPlayStatus(LSMessage& message) {
     responsePayload.put("eventType", "playStatus");
     responsePayload.put("returnValue", true);
     responsePayload.put("subscribed", true);
-    PMLOG_INFO(CONST_MODULE_MCS, "%s send subscription response :%s", __FUNCTION__, responsePayload.stringify().c_str());
+    std::string subscriptionResponse = responsePayload.stringify();
+    PMLOG_INFO(CONST_MODULE_MCS, "%s send subscription response :%s", __FUNCTION__, subscriptionResponse.c_str());
     /*Add subscription for receiveMediaPlaybackInfo*/
     CLSError lserror;
-    if (!LSSubscriptionReply(lsHandle_,"receiveMediaPlaybackInfo" , responsePayload.stringify().c_str(), &lserror)) {
+    if (!LSSubscriptionReply(lsHandle_,"receiveMediaPlaybackInfo" , subscriptionResponse.c_str(), &lserror)) {
       PMLOG_ERROR(CONST_MODULE_MCS,"%s LSSubscriptionReply failed", __FUNCTION__);
       errorCode = MCS_ERROR_SUBSCRIPTION_REPLY_FAILED;
       sendErrorResponse(errorCode, request);
@@ -1269,7 +1653,7 @@ bool MediaControlService::setMediaMuteStatus (LSMessage & message){
     return true;
   }
 
-  if (ptrMediaControlPrivate_->muteStatus_) {
+  if (ptrMediaControlPrivate_->muteStatus_ && hasSubscribers(lsHandle_, "receiveMediaPlaybackInfo")) {
     /*Get display ID from media ID*/
     int displayId = ptrMediaSessionMgr_->getDisplayIdForMedia(mediaId);
     //ToDo : Below platform check to be removed once dual blueetooth support in OSE
@@ -1292,10 +1676,11 @@ bool MediaControlService::setMediaMuteStatus (LSMessage & message){
 
     responsePayload.put("returnValue", true);
     responsePayload.put("subscribed", true);
-    PMLOG_INFO(CONST_MODULE_MCS, "%s send subscription response :%s", __FUNCTION__, responsePayload.stringify().c_str());
+    std::string subscriptionResponse = responsePayload.stringify();
+    PMLOG_INFO(CONST_MODULE_MCS, "%s send subscription response :%s", __FUNCTION__, subscriptionResponse.c_str());
     /*LSSubscriptionReply for receiveMediaPlaybackInfo*/
     CLSError lserror;
-    if (!LSSubscriptionReply(lsHandle_,"receiveMediaPlaybackInfo" , responsePayload.stringify().c_str(), &lserror)) {
+    if (!LSSubscriptionReply(lsHandle_,"receiveMediaPlaybackInfo" , subscriptionResponse.c_str(), &lserror)) {
       errorCode = MCS_ERROR_SUBSCRIPTION_REPLY_FAILED;
       sendErrorResponse(errorCode, request);
       return true;
@@ -1342,7 +1727,7 @@ bool MediaControlService::setMediaPlayPosition (LSMessage & message){
     return true;
   }
 
-  if (ptrMediaControlPrivate_->playPosition_) {
+  if (ptrMediaControlPrivate_->playPosition_ && hasSubscribers(lsHandle_, "receiveMediaPlaybackInfo")) {
     /*Get display ID from media ID*/
     int displayId = ptrMediaSessionMgr_->getDisplayIdForMedia(mediaId);
     //ToDo : Below platform check to be removed once dual blueetooth support in OSE
@@ -1365,10 +1750,11 @@ bool MediaControlService::setMediaPlayPosition (LSMessage & message){
 
     responsePayload.put("returnValue", true);
     responsePayload.put("subscribed", true);
-    PMLOG_INFO(CONST_MODULE_MCS, "%s send subscription response :%s", __FUNCTION__, responsePayload.stringify().c_str());
+    std::string subscriptionResponse = responsePayload.stringify();
+    PMLOG_INFO(CONST_MODULE_MCS, "%s send subscription response :%s", __FUNCTION__, subscriptionResponse.c_str());
     /*LSSubscriptionReply for receiveMediaPlaybackInfo*/
     CLSError lserror;
-    if (!LSSubscriptionReply(lsHandle_,"receiveMediaPlaybackInfo" , responsePayload.stringify().c_str(), &lserror)) {
+    if (!LSSubscriptionReply(lsHandle_,"receiveMediaPlaybackInfo" , subscriptionResponse.c_str(), &lserror)) {
       PMLOG_ERROR(CONST_MODULE_MCS,"%s LSSubscriptionReply failed", __FUNCTION__);
       errorCode = MCS_ERROR_SUBSCRIPTION_REPLY_FAILED;
       sendErrorResponse(errorCode, request);
@@ -1459,88 +1845,16 @@ bool MediaControlService::receiveMediaPlaybackInfo (LSMessage & message){
     sendErrorResponse(errorCode, request);
     return true;
   }
-  /*get mediaId from displayId*/
-  std::string mediaId = ptrMediaSessionMgr_->getMediaIdFromDisplayId(displayId);
-
-  pbnjson::JValue responsePayload = pbnjson::Object();
-  if(eventType == "playPosition" || eventType.empty()) {
-    std::string playPosition;
-    ptrMediaSessionMgr_->getMediaPlayPosition(mediaId, playPosition);
-    responsePayload.put("playPosition", playPosition);
-  }
-  if(eventType == "playStatus" ||eventType.empty()) {
-    std::string playStatus;
-    ptrMediaSessionMgr_->getMediaPlayStatus(mediaId, playStatus);
-    responsePayload.put("playStatus", playStatus);
-  }
-  if(eventType == "muteStatus" || eventType.empty()){
-    std::string muteStatus;
-    ptrMediaSessionMgr_->getMediaMuteStatus(mediaId, muteStatus);
-    responsePayload.put("muteStatus", muteStatus);
-  }
-  if(eventType == "mediaMetaData" || eventType.empty()){
-    pbnjson::JObject metaDataObj;
-    updateMetaDataResponse(mediaId, metaDataObj);
-    responsePayload.put("mediaMetaData", metaDataObj);
-  }
-  if(eventType == "coverArt" || eventType.empty()) {
-    std::vector<mediaCoverArt> objCoverArt;
-    pbnjson::JValue coverArtArray = pbnjson::Array();
-
-    ptrMediaSessionMgr_->getMediaCoverArt(mediaId, objCoverArt);
-
-    for (auto &element : objCoverArt) {
-      pbnjson::JValue coverArtItem = pbnjson::Object();
-
-      coverArtItem.put("src", element.getSource());
-      coverArtItem.put("type", element.getType());
-
-      std::vector<coverArtSize> sizes = element.getSize();
-
-      pbnjson::JValue coverArtSizes = pbnjson::Array();
-      for(auto &size : sizes) {
-        pbnjson::JValue sizesObj = pbnjson::Object();
-
-        sizesObj.put("width", size.width);
-        sizesObj.put("height", size.height);
-        coverArtSizes.append(sizesObj);
-      }
-      coverArtItem.put("sizes", coverArtSizes);
-      coverArtArray.append(coverArtItem);
-    }
-    responsePayload.put("coverArt", coverArtArray);
-  }
-  if (eventType == "supportedActions" || eventType.empty()) {
-    std::vector<std::string> objActionList;
-    pbnjson::JValue actionListArray = pbnjson::Array();
-
-    ptrMediaSessionMgr_->getActionList(mediaId, objActionList);
-
-    for (auto &element : objActionList) {
-      actionListArray.append(pbnjson::JValue(element));
-    }
-    responsePayload.put("supportedActions", actionListArray);
-  }
-  if(!eventType.empty())
-    responsePayload.put("eventType", eventType);
-
-  mediaSession objMediaSession;
-  errorCode = ptrMediaSessionMgr_->getMediaSessionInfo(mediaId, objMediaSession);
-  if(errorCode != MCS_ERROR_NO_ERROR) {
-    PMLOG_INFO(CONST_MODULE_MCS, "SessionInfo not found for mediaId : %s", mediaId.c_str());
-  }
-
-  responsePayload.put("mediaId", mediaId);
-  responsePayload.put("appId", objMediaSession.getAppId());
-
-  responsePayload.put("displayId", displayId);
-  responsePayload.put("returnValue", true);
-  responsePayload.put("subscribed", true);
+  std::string subscriptionResponse;
+  if (eventType.empty())
+    subscriptionResponse = getPlaybackInfoSnapshot(displayId);
+  else
+    subscriptionResponse = buildPlaybackInfoPayload(displayId, eventType).stringify();
 
-  PMLOG_INFO(CONST_MODULE_MCS, "%s send subscription response :%s", __FUNCTION__, responsePayload.stringify().c_str());
+  PMLOG_INFO(CONST_MODULE_MCS, "%s send subscription response :%s", __FUNCTION__, subscriptionResponse.c_str());
   /*LSSubscriptionReply for receiveMediaPlaybackInfo*/
   CLSError lserror;
-  if (!LSSubscriptionReply(lsHandle_,"receiveMediaPlaybackInfo" , responsePayload.stringify().c_str(), &lserror)){
+  if (!LSSubscriptionReply(lsHandle_,"receiveMediaPlaybackInfo" , subscriptionResponse.c_str(), &lserror)){
     PMLOG_ERROR(CONST_MODULE_MCS,"%s LSSubscriptionReply failed", __FUNCTION__);
     errorCode = MCS_ERROR_SUBSCRIPTION_REPLY_FAILED;
     sendErrorResponse(errorCode, request);
@@ -1697,7 +2011,7 @@ bool MediaControlService::setMediaCoverArt(LSMessage& message) {
     return true;
   }
 
-  if (ptrMediaControlPrivate_->coverArt_) {
+  if (ptrMediaControlPrivate_->coverArt_ && hasSubscribers(lsHandle_, "receiveMediaPlaybackInfo")) {
     //Create response to share cover art details to subscribed client
     pbnjson::JValue responsePayload = pbnjson::Object();
     responsePayload.put("displayId", 0);
@@ -1716,11 +2030,12 @@ bool MediaControlService::setMediaCoverArt(LSMessage& message) {
 
     responsePayload.put("returnValue", true);
 
-    PMLOG_INFO(CONST_MODULE_MCS, "%s send subscription response :%s", __FUNCTION__, responsePayload.stringify().c_str());
+    std::string subscriptionResponse = responsePayload.stringify();
+    PMLOG_INFO(CONST_MODULE_MCS, "%s send subscription response :%s", __FUNCTION__, subscriptionResponse.c_str());
 
     /*Reply coverArt details to receiveMediaPlaybackInfo*/
     CLSError lserror;
-    if (!LSSubscriptionReply(lsHandle_,"receiveMediaPlaybackInfo" , responsePayload.stringify().c_str(), &lserror)) {
+    if (!LSSubscriptionReply(lsHandle_,"receiveMediaPlaybackInfo" , subscriptionResponse.c_str(), &lserror)) {
       errorCode = MCS_ERROR_SUBSCRIPTION_REPLY_FAILED;
       sendErrorResponse(errorCode, request);
       return true;
@@ -1779,6 +2094,90 @@ bool MediaControlService::testKeyEvent(LSMessage &message) {
 }
 #endif
 
+pbnjson::JValue MediaControlService::buildPlaybackInfoPayload(const int &displayId, const std::string &eventType) {
+  /*get mediaId from displayId*/
+  std::string mediaId = ptrMediaSessionMgr_->getMediaIdFromDisplayId(displayId);
+
+  pbnjson::JValue responsePayload = pbnjson::Object();
+  if(eventType == "playPosition" || eventType.empty()) {
+    std::string playPosition;
+    ptrMediaSessionMgr_->getMediaPlayPosition(mediaId, playPosition);
+    responsePayload.put("playPosition", playPosition);
+  }
+  if(eventType == "playStatus" ||eventType.empty()) {
+    std::string playStatus;
+    ptrMediaSessionMgr_->getMediaPlayStatus(mediaId, playStatus);
+    responsePayload.put("playStatus", playStatus);
+  }
+  if(eventType == "muteStatus" || eventType.empty()){
+    std::string muteStatus;
+    ptrMediaSessionMgr_->getMediaMuteStatus(mediaId, muteStatus);
+    responsePayload.put("muteStatus", muteStatus);
+  }
+  if(eventType == "mediaMetaData" || eventType.empty()){
+    pbnjson::JObject metaDataObj;
+    updateMetaDataResponse(mediaId, metaDataObj);
+    responsePayload.put("mediaMetaData", metaDataObj);
+  }
+  if(eventType == "coverArt" || eventType.empty()) {
+    std::vector<mediaCoverArt> objCoverArt;
+    ptrMediaSessionMgr_->getMediaCoverArt(mediaId, objCoverArt);
+    responsePayload.put("coverArt", createCoverArtArray(objCoverArt));
+  }
+  if (eventType == "supportedActions" || eventType.empty()) {
+    std::vector<std::string> objActionList;
+    pbnjson::JValue actionListArray = pbnjson::Array();
+
+    ptrMediaSessionMgr_->getActionList(mediaId, objActionList);
+
+    for (auto &element : objActionList) {
+      actionListArray.append(pbnjson::JValue(element));
+    }
+    responsePayload.put("supportedActions", actionListArray);
+  }
+  if(!eventType.empty())
+    responsePayload.put("eventType", eventType);
+
+  mediaSession objMediaSession;
+  if(ptrMediaSessionMgr_->getMediaSessionInfo(mediaId, objMediaSession) != MCS_ERROR_NO_ERROR) {
+    PMLOG_INFO(CONST_MODULE_MCS, "SessionInfo not found for mediaId : %s", mediaId.c_str());
+  }
+
+  responsePayload.put("mediaId", mediaId);
+  responsePayload.put("appId", objMediaSession.getAppId());
+
+  responsePayload.put("displayId", displayId);
+  responsePayload.put("returnValue", true);
+  responsePayload.put("subscribed", true);
+
+  return responsePayload;
+}
+
+const std::string& MediaControlService::getPlaybackInfoSnapshot(const int &displayId) {
+  //full state payload is serialized again only when a session changed since it was cached.
+  //a position update alone is spliced in between the cached halves
+  unsigned long snapshotVersion = ptrMediaSessionMgr_->getStateVersion();
+  unsigned long positionVersion = ptrMediaSessionMgr_->getPositionVersion();
+  PlaybackInfoSnapshot &snapshot = playbackInfoSnapshot_[displayId];
+  if (snapshot.payload.empty() || snapshot.snapshotVersion != snapshotVersion) {
+    PMLOG_DEBUG("%s rebuild snapshot for displayId : %d, version : %lu", __FUNCTION__, displayId, snapshotVersion);
+    pbnjson::JValue payload = buildPlaybackInfoPayload(displayId, CSTR_EMPTY);
+    payload.remove("playPosition");
+    std::string rest = payload.stringify();
+    snapshot.prefix = "{\"playPosition\":";
+    snapshot.suffix = (rest.size() > 2) ? "," + rest.substr(1) : "}";
+    snapshot.snapshotVersion = snapshotVersion;
+    snapshot.payload.clear();
+  }
+  if (snapshot.payload.empty() || snapshot.positionVersion != positionVersion) {
+    std::string playPosition;
+    ptrMediaSessionMgr_->getMediaPlayPosition(ptrMediaSessionMgr_->getMediaIdFromDisplayId(displayId), playPosition);
+    snapshot.payload = snapshot.prefix + quoteJsonString(playPosition) + snapshot.suffix;
+    snapshot.positionVersion = positionVersion;
+  }
+  return snapshot.payload;
+}
+
 int  MediaControlService:: updateMetaDataResponse (const std::string &mediaId,  pbnjson::JObject &metaDataObj) {
   int errorCode = MCS_ERROR_NO_ERROR;
   if(ptrMediaSessionMgr_){
@@ -17,11 +17,15 @@
 /*-----------------------------------------------------------------------------*/
 #include "MediaSessionManager.h"
 #include "MediaControlTypes.h"
-#include "thread"
+#include <algorithm>
 #include <unistd.h>
 #include "Lsutils.h"
 #include "Utils.h"
 
+static int coverArtEdgeForDisplay(int displayId) {
+  return COVERART_DISPLAY_EDGES[displayId == 1 ? 1 : 0];
+}
+
 MediaSessionManager::MediaSessionManager() :
   mapMediaSessionInfo_() {
   fileManager = new FileManager;
@@ -47,6 +51,7 @@ int MediaSessionManager::addMediaSession (const std::string& mediaId,
   }
 
   mediaSession objMediaSession(mediaId, appId);
+  objMediaSession.setVersion(updateStateVersion());
   mapMediaSessionInfo_[mediaId] = std::move(objMediaSession);
   return MCS_ERROR_NO_ERROR;
 }
@@ -57,6 +62,9 @@ int MediaSessionManager::activateMediaSession (const std::string& mediaId) {
   if(itr != mapMediaSessionInfo_.end()) {
     //add mediaId to receiver stack
     objRequestRcvr_.addClient(mediaId);
+    updateStateVersion();
+    prefetchCoverArt(mediaId);
+    pinActiveCoverArt();
     return MCS_ERROR_NO_ERROR;
   }
 
@@ -70,6 +78,8 @@ int MediaSessionManager::deactivateMediaSession (const std::string& mediaId) {
   if(itr != mapMediaSessionInfo_.end()) {
     //delete media client from receiver stack
     objRequestRcvr_.removeClient(mediaId);
+    updateStateVersion();
+    pinActiveCoverArt();
     return MCS_ERROR_NO_ERROR;
   }
   PMLOG_ERROR(CONST_MODULE_MSM, "%s MediaId doesnt exists", __FUNCTION__);
@@ -83,12 +93,59 @@ int MediaSessionManager::removeMediaSession (const std::string& mediaId) {
     mapMediaSessionInfo_.erase(itr->first);
     //delete media client from receiver stack
     objRequestRcvr_.removeClient(mediaId);
+    updateStateVersion();
+    pinActiveCoverArt();
     return MCS_ERROR_NO_ERROR;
   }
   PMLOG_ERROR(CONST_MODULE_MSM, "%s MediaId doesnt exists", __FUNCTION__);
   return MCS_ERROR_INVALID_MEDIAID;
 }
 
+std::vector<int> MediaSessionManager::addMediaSessions (
+                   const std::vector<std::pair<std::string, std::string>>& sessions) {
+  PMLOG_INFO(CONST_MODULE_MSM, "%s count : %zu", __FUNCTION__, sessions.size());
+  std::vector<int> result;
+  result.reserve(sessions.size());
+  for (const auto& session : sessions) {
+    const std::string& mediaId = session.first;
+    if(mapMediaSessionInfo_.find(mediaId) != mapMediaSessionInfo_.end()) {
+      PMLOG_ERROR(CONST_MODULE_MSM, "%s mediaId %s already regsitered", __FUNCTION__, mediaId.c_str());
+      result.push_back(MCS_ERROR_SESSION_ALREADY_REGISTERED);
+      continue;
+    }
+    mediaSession objMediaSession(mediaId, session.second);
+    objMediaSession.setVersion(updateStateVersion());
+    mapMediaSessionInfo_.emplace(mediaId, std::move(objMediaSession));
+    result.push_back(MCS_ERROR_NO_ERROR);
+  }
+  return result;
+}
+
+std::vector<int> MediaSessionManager::removeMediaSessions (const std::vector<std::string>& mediaIds) {
+  PMLOG_INFO(CONST_MODULE_MSM, "%s count : %zu", __FUNCTION__, mediaIds.size());
+  std::vector<int> result;
+  result.reserve(mediaIds.size());
+  std::set<std::string> removedMediaIds;
+  for (const auto& mediaId : mediaIds) {
+    const auto& itr = mapMediaSessionInfo_.find(mediaId);
+    if(itr == mapMediaSessionInfo_.end()) {
+      PMLOG_ERROR(CONST_MODULE_MSM, "%s MediaId %s doesnt exists", __FUNCTION__, mediaId.c_str());
+      result.push_back(MCS_ERROR_INVALID_MEDIAID);
+      continue;
+    }
+    mapMediaSessionInfo_.erase(itr);
+    removedMediaIds.insert(mediaId);
+    result.push_back(MCS_ERROR_NO_ERROR);
+  }
+  if(!removedMediaIds.empty()) {
+    //delete media clients from receiver stack
+    objRequestRcvr_.removeClients(removedMediaIds);
+    updateStateVersion();
+    pinActiveCoverArt();
+  }
+  return result;
+}
+
 int MediaSessionManager::getMediaMetaData(const std::string& mediaId,
                                            mediaMetaData& objMetaData) {
   PMLOG_INFO(CONST_MODULE_MSM, "%s mediaId : %s", __FUNCTION__, mediaId.c_str());
@@ -138,6 +195,7 @@ int MediaSessionManager::getMediaSessionInfo(const std::string& mediaId,
     objMediaSession.setAppId(itr->second.getAppId());
     objMediaSession.setPlayStatus(itr->second.getPlayStatus());
     objMediaSession.setMetaData(itr->second.getMediaMetaDataObj());
+    objMediaSession.setVersion(itr->second.getVersion());
     return MCS_ERROR_NO_ERROR;
   }
 
@@ -183,6 +241,18 @@ int MediaSessionManager::getMediaPlayPosition(const std::string& mediaId,
   PMLOG_ERROR(CONST_MODULE_MSM, "%s MediaId doesnt exists", __FUNCTION__);
   return MCS_ERROR_INVALID_MEDIAID;
 }
+
+int MediaSessionManager::getMediaSessionVersion(const std::string& mediaId,
+                                                 unsigned long& version) {
+  const auto& itr = mapMediaSessionInfo_.find(mediaId);
+  if(itr != mapMediaSessionInfo_.end()) {
+    version = itr->second.getVersion();
+    return MCS_ERROR_NO_ERROR;
+  }
+  PMLOG_ERROR(CONST_MODULE_MSM, "%s MediaId doesnt exists", __FUNCTION__);
+  return MCS_ERROR_INVALID_MEDIAID;
+}
+
 int MediaSessionManager::setMediaMetaData(const std::string& mediaId,
                                            const mediaMetaData& objMetaData) {
   PMLOG_INFO(CONST_MODULE_MSM, "%s mediaId : %s", __FUNCTION__, mediaId.c_str());
@@ -190,6 +260,7 @@ int MediaSessionManager::setMediaMetaData(const std::string& mediaId,
   if(itr != mapMediaSessionInfo_.end()) {
     //save metadata info
     itr->second.setMetaData(objMetaData);
+    itr->second.setVersion(updateStateVersion());
     return MCS_ERROR_NO_ERROR;
   }
   PMLOG_ERROR(CONST_MODULE_MSM, "%s MediaId doesnt exists", __FUNCTION__);
@@ -203,6 +274,10 @@ int MediaSessionManager::setMediaCoverArt(const std::string& mediaId,
   if(itr != mapMediaSessionInfo_.end()) {
     //save cover art info
     itr->second.setCoverArt(objCoverArt);
+    itr->second.setVersion(updateStateVersion());
+    if (mediaId == getCurrentActiveSession())
+      prefetchCoverArt(mediaId);
+    pinActiveCoverArt();
     return MCS_ERROR_NO_ERROR;
   }
   PMLOG_ERROR(CONST_MODULE_MSM, "%s MediaId doesnt exists", __FUNCTION__);
@@ -216,6 +291,7 @@ int MediaSessionManager::setMediaAction(const std::string& mediaId,
   if(itr != mapMediaSessionInfo_.end()) {
     //save action handler info
     itr->second.setAction(mediaAction);
+    itr->second.setVersion(updateStateVersion());
     return MCS_ERROR_NO_ERROR;
   }
   PMLOG_ERROR(CONST_MODULE_MSM, "%s MediaId doesnt exists", __FUNCTION__);
@@ -235,6 +311,7 @@ int MediaSessionManager::setMediaPlayStatus(const std::string& mediaId,
   const auto& itr = mapMediaSessionInfo_.find(mediaId);
   if(itr != mapMediaSessionInfo_.end()) {
     itr->second.setPlayStatus(playStatus);
+    itr->second.setVersion(updateStateVersion());
     return MCS_ERROR_NO_ERROR;
   }
   PMLOG_ERROR(CONST_MODULE_MSM, "%s MediaId doesnt exists", __FUNCTION__);
@@ -249,6 +326,7 @@ int MediaSessionManager::setMediaMuteStatus(const std::string& mediaId,
   const auto& itr = mapMediaSessionInfo_.find(mediaId);
   if(itr != mapMediaSessionInfo_.end()) {
     itr->second.setMuteStatus(muteStatus);
+    itr->second.setVersion(updateStateVersion());
     return MCS_ERROR_NO_ERROR;
   }
   PMLOG_ERROR(CONST_MODULE_MSM, "%s MediaId doesnt exists", __FUNCTION__);
@@ -263,6 +341,7 @@ int MediaSessionManager::setMediaPlayPosition(const std::string& mediaId,
   const auto& itr = mapMediaSessionInfo_.find(mediaId);
   if(itr != mapMediaSessionInfo_.end()) {
     itr->second.setPlayposition(playPosition);
+    positionVersion_++;
     return MCS_ERROR_NO_ERROR;
   }
   PMLOG_ERROR(CONST_MODULE_MSM, "%s MediaId doesnt exists", __FUNCTION__);
@@ -289,6 +368,29 @@ std::vector<std::string> MediaSessionManager::getMediaSessionList(const std::str
   return mediaSessionId;
 }
 
+std::vector<mediaSession> MediaSessionManager::getMediaSessionSnapshot(const std::string& appId,
+                                                                      const int& displayId,
+                                                                      const size_t& offset,
+                                                                      const size_t& limit,
+                                                                      size_t& totalCount) {
+  PMLOG_INFO(CONST_MODULE_MSM, "%s appId : %s displayId : %d offset : %zu limit : %zu", __FUNCTION__,
+                                appId.c_str(), displayId, offset, limit);
+  std::vector<mediaSession> mediaSessions;
+  mediaSessions.reserve(std::min(limit, mapMediaSessionInfo_.size()));
+  totalCount = 0;
+  //one pass over the session table, sessions outside the requested page are only counted
+  for (const auto& itr : mapMediaSessionInfo_) {
+    if(!appId.empty() && appId != itr.second.getAppId())
+      continue;
+    if(displayId >= 0 && displayId != getDisplayIdForApp(itr.second.getAppId()))
+      continue;
+    if(totalCount >= offset && mediaSessions.size() < limit)
+      mediaSessions.push_back(itr.second);
+    ++totalCount;
+  }
+  return mediaSessions;
+}
+
 std::string MediaSessionManager::getCurrentActiveSession() {
   return objRequestRcvr_.getLastActiveClient();
 }
@@ -318,6 +420,14 @@ int MediaSessionManager::getDisplayIdForMedia(const std::string& mediaId) {
   return 0;
 }
 
+int MediaSessionManager::getDisplayIdForApp(const std::string& appId) {
+#if defined(FEATURE_DUAL_DISPLAY)
+  if(!appId.empty())
+    return (appId.back()-48);
+#endif
+  return 0;
+}
+
 std::string MediaSessionManager::getMediaIdFromDisplayId(const int& displayId) {
   PMLOG_INFO(CONST_MODULE_MSM, "%s displayId = %d", __FUNCTION__, displayId);
   for (const auto& itr : mapMediaSessionInfo_) {
@@ -334,36 +444,99 @@ std::string MediaSessionManager::getMediaIdFromDisplayId(const int& displayId) {
   return CSTR_EMPTY;
 }
 
-bool MediaSessionManager::download(const std::string& url) {
-  PMLOG_INFO(CONST_MODULE_MSM, "%s CoverArt Uri : %s", __FUNCTION__, url.c_str());
+void MediaSessionManager::onCoverArtDownloaded(const std::string& url, int displayId,
+                                               const std::shared_ptr<LSMessage>& requester, bool downloaded,
+                                               const std::string& downloadedFilePath) {
+  PMLOG_INFO(CONST_MODULE_MSM, "%s CoverArt Uri : %s downloaded : %d path : %s", __FUNCTION__,
+             url.c_str(), downloaded, downloadedFilePath.c_str());
+
+  //file stays cached for later requests, nobody is waiting for the path right now
+  if (!requester) {
+    PMLOG_INFO(CONST_MODULE_MSM, "%s no subscribed requester for %s", __FUNCTION__, url.c_str());
+    return;
+  }
+
+  if (!downloaded) {
+    replyCoverArtPath(requester, url, false, downloadedFilePath, "", "");
+    return;
+  }
+
+  //scaled for the display, a failed resize falls back to the original
+  int edge = coverArtEdgeForDisplay(displayId);
+  fileManager->requestVariant(url, edge,
+    [this, requester, url, edge, downloadedFilePath](bool scaled, const std::string& scaledPath) {
+      replyCoverArtPath(requester, url, true, downloadedFilePath, scaled ? scaledPath : downloadedFilePath,
+                        scaled ? fileManager->getRawVariantPath(url, edge) : "");
+    });
+}
 
+void MediaSessionManager::replyCoverArtPath(const std::shared_ptr<LSMessage>& requester, const std::string& url,
+                                            bool downloaded, const std::string& filePath,
+                                            const std::string& scaledPath, const std::string& rawPath) {
   pbnjson::JValue responsePayload = pbnjson::Object();
   responsePayload.put("src", url);
+  responsePayload.put("returnValue", downloaded);
+  responsePayload.put("subscribed", true);
+  responsePayload.put("srcPath", filePath);
+  if (downloaded)
+    responsePayload.put("scaledPath", scaledPath);
+  //decoded pixels behind a RawImageHeader, only with the raw tier built in
+  if (!rawPath.empty())
+    responsePayload.put("rawPath", rawPath);
+
+  //only the client that asked for this uri, not every cover art subscriber
+  CLSError lserror;
+  if (!LSMessageReply(lshandle_, requester.get(), responsePayload.stringify().c_str(), &lserror)){
+      PMLOG_ERROR(CONST_MODULE_MSM,"%s LSMessageReply failed for getMediaCoverArtPath", __FUNCTION__);
+  }
+}
 
-  try {
-    std::string downloadedFilePath = fileManager->getURI(url, COVERART_FILE_PATH);
-    PMLOG_INFO(CONST_MODULE_MSM, "%s Download completed at %s", __FUNCTION__, downloadedFilePath.c_str());
-
-    responsePayload.put("returnValue", true);
-    responsePayload.put("subscribed", true);
-    responsePayload.put("srcPath", downloadedFilePath);
-  } catch (...) {
-    PMLOG_INFO(CONST_MODULE_MSM, "%s Download error", __FUNCTION__);
-    responsePayload.put("returnValue", false);
-    responsePayload.put("subscribed", true);
-    responsePayload.put("srcPath", "");
+void MediaSessionManager::prefetchCoverArt(const std::string& mediaId) {
+  if (!COVERART_PREFETCH)
+    return;
+  const auto& itr = mapMediaSessionInfo_.find(mediaId);
+  if(itr == mapMediaSessionInfo_.end())
+    return;
+
+  //low priority, a getMediaCoverArtPath for the same uri promotes it.
+  //cached art is read ahead and revalidated if stale
+  int edge = coverArtEdgeForDisplay(getDisplayIdForApp(itr->second.getAppId()));
+  for (const auto& coverArt : itr->second.getMediaCoverArtObj()) {
+    std::string uri = coverArt.getSource();
+    if (uri.empty())
+      continue;
+    fileManager->warmURI(uri, edge);
+    fileManager->requestURI(uri, COVERART_FILE_PATH, DownloadScheduler::PRIORITY_LOW,
+      [this, uri, edge](bool downloaded, const std::string& filePath) {
+        if (downloaded)
+          fileManager->requestVariant(uri, edge, nullptr);
+      });
   }
+}
 
-  CLSError lserror;
-  if (!LSSubscriptionReply(lshandle_,"getMediaCoverArtPath" , responsePayload.stringify().c_str(), &lserror)){
-      PMLOG_ERROR(CONST_MODULE_MSM,"%s LSSubscriptionReply failed for getMediaCoverArtPath", __FUNCTION__);
-      return true;
+void MediaSessionManager::pinActiveCoverArt() {
+  //art of every active session stays cached, whatever else gets browsed meanwhile
+  std::vector<std::pair<std::string, int>> pinned;
+  for (const auto& mediaId : objRequestRcvr_.getClientList()) {
+    const auto& itr = mapMediaSessionInfo_.find(mediaId);
+    if(itr == mapMediaSessionInfo_.end())
+      continue;
+    int edge = coverArtEdgeForDisplay(getDisplayIdForApp(itr->second.getAppId()));
+    for (const auto& coverArt : itr->second.getMediaCoverArtObj()) {
+      if (!coverArt.getSource().empty())
+        pinned.emplace_back(coverArt.getSource(), edge);
+    }
   }
+  fileManager->setPinnedCoverArt(pinned);
+}
 
-  return true;
+bool MediaSessionManager::getCachedCoverArt(const std::string& uri, int displayId,
+                                            FileManager::CachedCoverArt& paths) {
+  return fileManager->getCachedCoverArt(uri, coverArtEdgeForDisplay(displayId), paths);
 }
 
-int MediaSessionManager::coverArtDownload(const std::string& mediaId, const std::vector<std::string> uris) {
+int MediaSessionManager::coverArtDownload(const std::string& mediaId, int displayId,
+                                          const std::vector<std::string> uris, LSMessage* message) {
   PMLOG_INFO(CONST_MODULE_MSM, "%s mediaId : %s", __FUNCTION__, mediaId.c_str());
 
   const auto& itr = mapMediaSessionInfo_.find(mediaId);
@@ -372,10 +545,20 @@ int MediaSessionManager::coverArtDownload(const std::string& mediaId, const std:
     return MCS_ERROR_NO_ACTIVE_SESSION;
   }
 
+  //the request is kept until every uri it asked for has been answered
+  std::shared_ptr<LSMessage> requester;
+  if (message != nullptr && !uris.empty()) {
+    LSMessageRef(message);
+    requester.reset(message, LSMessageUnref);
+  }
+
+  //completions come back on the main loop, replies are sent from there
   for(auto &uri : uris)
   {
-    std::thread tidDownload = std::thread(&MediaSessionManager::download, this, uri);
-    tidDownload.detach();
+    fileManager->requestURI(uri, COVERART_FILE_PATH, DownloadScheduler::PRIORITY_HIGH,
+      [this, uri, displayId, requester](bool downloaded, const std::string& filePath) {
+        onCoverArtDownloaded(uri, displayId, requester, downloaded, filePath);
+      });
   }
 
   return MCS_ERROR_NO_ERROR;
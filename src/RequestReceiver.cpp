@@ -60,6 +60,14 @@ void RequestReceiver::removeClient (const std::string& mediaId) {
   return;
 }
 
+void RequestReceiver::removeClients (const std::set<std::string>& mediaIds) {
+  PMLOG_INFO(CONST_MODULE_RR, "%s count : %zu", __FUNCTION__, mediaIds.size());
+  //single pass over the stack instead of one scan per mediaId
+  clientListInfo_.remove_if([&mediaIds](const std::string& mediaId) {
+    return mediaIds.count(mediaId) > 0;
+  });
+}
+
 std::string RequestReceiver::getLastActiveClient () {
   PMLOG_INFO(CONST_MODULE_RR, "%s ", __FUNCTION__);
 
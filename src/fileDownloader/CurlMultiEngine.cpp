@@ -0,0 +1,244 @@
+// Copyright (c) 2024 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+/*-----------------------------------------------------------------------------*/
+#include "CurlMultiEngine.h"
+#include "PmLogLib.h"
+#include "MediaControlTypes.h"
+#include "Utils.h"
+
+static void logTlsBackend()
+{
+    curl_version_info_data *version_info = curl_version_info(CURLVERSION_NOW);
+    if (version_info->ssl_version) {
+        PMLOG_INFO(CONST_MODULE_MCD, "Current SSL/TLS version: %s", version_info->ssl_version);
+    } else {
+        PMLOG_INFO(CONST_MODULE_MCD, "No SSL/TLS library detected.");
+    }
+}
+
+CurlMultiEngine& CurlMultiEngine::getInstance()
+{
+    static CurlMultiEngine engine;
+    return engine;
+}
+
+CurlMultiEngine::CurlMultiEngine()
+{
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    logTlsBackend();
+
+    // dns entries and tls session ids survive across transfers, connections
+    // are already pooled by the multi handle but sharing keeps that explicit.
+    // single threaded, so no lock callbacks are needed
+    share_ = curl_share_init();
+    if (share_ != nullptr)
+    {
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+        curl_share_setopt(share_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+    }
+
+    multi_ = curl_multi_init();
+    if (multi_ == nullptr)
+    {
+        PMLOG_ERROR(CONST_MODULE_MCD, "%s curl_multi_init failed", __FUNCTION__);
+        return;
+    }
+    curl_multi_setopt(multi_, CURLMOPT_SOCKETFUNCTION, &CurlMultiEngine::onSocket);
+    curl_multi_setopt(multi_, CURLMOPT_SOCKETDATA, this);
+    curl_multi_setopt(multi_, CURLMOPT_TIMERFUNCTION, &CurlMultiEngine::onTimer);
+    curl_multi_setopt(multi_, CURLMOPT_TIMERDATA, this);
+}
+
+CurlMultiEngine::~CurlMultiEngine()
+{
+    if (timerId_ != 0)
+        g_source_remove(timerId_);
+    // pending transfers are dropped without running their callbacks
+    for (auto &transfer : transfers_)
+    {
+        curl_multi_remove_handle(multi_, transfer.first);
+        curl_easy_cleanup(transfer.first);
+    }
+    transfers_.clear();
+    for (CURL *easy : idleHandles_)
+        curl_easy_cleanup(easy);
+    idleHandles_.clear();
+    if (multi_ != nullptr)
+        curl_multi_cleanup(multi_);
+    if (share_ != nullptr)
+        curl_share_cleanup(share_);
+}
+
+CURL *CurlMultiEngine::acquireHandle()
+{
+    CURL *easy = nullptr;
+    if (!idleHandles_.empty())
+    {
+        easy = idleHandles_.back();
+        idleHandles_.pop_back();
+        // drops the options but keeps the handle's caches and live connections
+        curl_easy_reset(easy);
+    }
+    else
+    {
+        easy = curl_easy_init();
+    }
+
+    if (easy != nullptr && share_ != nullptr)
+        curl_easy_setopt(easy, CURLOPT_SHARE, share_);
+    return easy;
+}
+
+void CurlMultiEngine::releaseHandle(CURL *easy)
+{
+    if (easy == nullptr)
+        return;
+    if (idleHandles_.size() < MAX_IDLE_CURL_HANDLES)
+        idleHandles_.push_back(easy);
+    else
+        curl_easy_cleanup(easy);
+}
+
+CurlMultiEngine::Stats CurlMultiEngine::getStats() const
+{
+    Stats stats = stats_;
+    stats.idleHandles = idleHandles_.size();
+    return stats;
+}
+
+bool CurlMultiEngine::addTransfer(CURL *easy, const DoneCallback &onDone)
+{
+    if (multi_ == nullptr || easy == nullptr)
+        return false;
+
+    CURLMcode rc = curl_multi_add_handle(multi_, easy);
+    if (rc != CURLM_OK)
+    {
+        PMLOG_ERROR(CONST_MODULE_MCD, "%s curl_multi_add_handle failed : %s", __FUNCTION__, curl_multi_strerror(rc));
+        return false;
+    }
+    transfers_[easy] = onDone;
+    PMLOG_INFO(CONST_MODULE_MCD, "%s active transfers : %zu", __FUNCTION__, transfers_.size());
+    return true;
+}
+
+int CurlMultiEngine::onSocket(CURL *easy, curl_socket_t fd, int what, void *userp, void *socketp)
+{
+    CurlMultiEngine *engine = static_cast<CurlMultiEngine *>(userp);
+    guint sourceId = GPOINTER_TO_INT(socketp);
+
+    if (sourceId != 0)
+        g_source_remove(sourceId);
+
+    if (what == CURL_POLL_REMOVE)
+    {
+        curl_multi_assign(engine->multi_, fd, nullptr);
+        return 0;
+    }
+
+    int condition = G_IO_ERR | G_IO_HUP;
+    if (what & CURL_POLL_IN)
+        condition |= G_IO_IN;
+    if (what & CURL_POLL_OUT)
+        condition |= G_IO_OUT;
+
+    GIOChannel *channel = g_io_channel_unix_new(fd);
+    sourceId = g_io_add_watch(channel, static_cast<GIOCondition>(condition),
+                              &CurlMultiEngine::onSocketEvent, engine);
+    // the watch holds its own reference on the channel
+    g_io_channel_unref(channel);
+    curl_multi_assign(engine->multi_, fd, GINT_TO_POINTER(sourceId));
+    return 0;
+}
+
+int CurlMultiEngine::onTimer(CURLM *multi, long timeoutMs, void *userp)
+{
+    CurlMultiEngine *engine = static_cast<CurlMultiEngine *>(userp);
+    if (engine->timerId_ != 0)
+    {
+        g_source_remove(engine->timerId_);
+        engine->timerId_ = 0;
+    }
+    if (timeoutMs >= 0)
+        engine->timerId_ = g_timeout_add(static_cast<guint>(timeoutMs), &CurlMultiEngine::onTimeout, engine);
+    return 0;
+}
+
+gboolean CurlMultiEngine::onSocketEvent(GIOChannel *channel, GIOCondition condition, gpointer data)
+{
+    CurlMultiEngine *engine = static_cast<CurlMultiEngine *>(data);
+    int action = 0;
+    if (condition & G_IO_IN)
+        action |= CURL_CSELECT_IN;
+    if (condition & G_IO_OUT)
+        action |= CURL_CSELECT_OUT;
+    if (condition & (G_IO_ERR | G_IO_HUP))
+        action |= CURL_CSELECT_ERR;
+
+    // curl may remove or replace this watch from inside socketAction,
+    // glib drops a source removed during its own dispatch
+    engine->socketAction(g_io_channel_unix_get_fd(channel), action);
+    return G_SOURCE_CONTINUE;
+}
+
+gboolean CurlMultiEngine::onTimeout(gpointer data)
+{
+    CurlMultiEngine *engine = static_cast<CurlMultiEngine *>(data);
+    engine->timerId_ = 0;
+    engine->socketAction(CURL_SOCKET_TIMEOUT, 0);
+    return G_SOURCE_REMOVE;
+}
+
+void CurlMultiEngine::socketAction(curl_socket_t fd, int action)
+{
+    CURLMcode rc = curl_multi_socket_action(multi_, fd, action, &running_);
+    if (rc != CURLM_OK)
+        PMLOG_ERROR(CONST_MODULE_MCD, "%s curl_multi_socket_action failed : %s", __FUNCTION__, curl_multi_strerror(rc));
+    checkCompleted();
+}
+
+void CurlMultiEngine::checkCompleted()
+{
+    int pending = 0;
+    CURLMsg *msg = nullptr;
+    while ((msg = curl_multi_info_read(multi_, &pending)) != nullptr)
+    {
+        if (msg->msg != CURLMSG_DONE)
+            continue;
+
+        CURL *easy = msg->easy_handle;
+        CURLcode result = msg->data.result;
+        curl_multi_remove_handle(multi_, easy);
+
+        long newConnections = 0;
+        if (curl_easy_getinfo(easy, CURLINFO_NUM_CONNECTS, &newConnections) == CURLE_OK)
+            stats_.newConnections += newConnections;
+        stats_.transfers++;
+
+        DoneCallback onDone;
+        auto itr = transfers_.find(easy);
+        if (itr != transfers_.end())
+        {
+            onDone = std::move(itr->second);
+            transfers_.erase(itr);
+        }
+        if (onDone)
+            onDone(easy, result);
+        releaseHandle(easy);
+    }
+}
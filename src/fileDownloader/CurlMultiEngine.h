@@ -0,0 +1,75 @@
+// Copyright (c) 2024 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+#ifndef CURL_MULTI_ENGINE_H
+#define CURL_MULTI_ENGINE_H
+
+/*-----------------------------------------------------------------------------
+ (File Inclusions)
+ ------------------------------------------------------------------------------*/
+#include <functional>
+#include <unordered_map>
+#include <vector>
+#include <curl/curl.h>
+#include <glib.h>
+
+// drives curl easy handles through one curl_multi handle whose sockets and
+// timer are GSources on the default main context. everything runs on the
+// main loop, no threads involved.
+class CurlMultiEngine {
+public:
+    // called on the main loop, the easy handle goes back to the pool afterwards
+    using DoneCallback = std::function<void(CURL* easy, CURLcode result)>;
+
+    struct Stats {
+        unsigned long transfers = 0;
+        unsigned long newConnections = 0;
+        size_t idleHandles = 0;
+    };
+
+    static CurlMultiEngine& getInstance();
+    // reset handle from the idle pool, already attached to the share object
+    CURL* acquireHandle();
+    // hands a handle that was never added back to the pool
+    void releaseHandle(CURL* easy);
+    // takes ownership of the easy handle
+    bool addTransfer(CURL* easy, const DoneCallback& onDone);
+    size_t activeTransfers() const { return transfers_.size(); }
+    Stats getStats() const;
+
+private:
+    CurlMultiEngine();
+    ~CurlMultiEngine();
+    CurlMultiEngine(const CurlMultiEngine&) = delete;
+    CurlMultiEngine& operator=(const CurlMultiEngine&) = delete;
+
+    static int onSocket(CURL* easy, curl_socket_t fd, int what, void* userp, void* socketp);
+    static int onTimer(CURLM* multi, long timeoutMs, void* userp);
+    static gboolean onSocketEvent(GIOChannel* channel, GIOCondition condition, gpointer data);
+    static gboolean onTimeout(gpointer data);
+    void socketAction(curl_socket_t fd, int action);
+    void checkCompleted();
+
+    CURLM* multi_ = nullptr;
+    CURLSH* share_ = nullptr;
+    std::vector<CURL*> idleHandles_;
+    Stats stats_;
+    guint timerId_ = 0;
+    int running_ = 0;
+    std::unordered_map<CURL*, DoneCallback> transfers_;
+};
+
+#endif /*CURL_MULTI_ENGINE_H*/
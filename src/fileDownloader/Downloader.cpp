@@ -16,86 +16,489 @@
 
 /*-----------------------------------------------------------------------------*/
 #include "Downloader.h"
+#include "CurlMultiEngine.h"
 #include <iostream>
-#include <fstream>
+#include <vector>
 #include <memory>
 #include <stdexcept>
 #include <curl/curl.h>
+#include <glib.h>
 #include <sys/stat.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <fcntl.h>
+#include <algorithm>
+#include <iterator>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <unistd.h>
 #include "PmLogLib.h"
 #include "MediaControlTypes.h"
 #include "Utils.h"
 
-void print_tls_version()
-{
-  curl_version_info_data *version_info = curl_version_info(CURLVERSION_NOW);
-  if (version_info->ssl_version) {
-    PMLOG_INFO(CONST_MODULE_MCD, "Current SSL/TLS version: %s", version_info->ssl_version);;
-  } else
-  {
-     PMLOG_INFO(CONST_MODULE_MCD, "No SSL/TLS library detected.");
-  }
-}
+#ifndef COVERART_FSYNC_POLICY
+#define COVERART_FSYNC_POLICY 0
+#endif
 
-size_t Downloader::WriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
-    std::ofstream* file = static_cast<std::ofstream*>(userp);
-    size_t totalSize = size * nmemb;
-    file->write(static_cast<char*>(contents), totalSize);
-    return totalSize;
+static Downloader::FsyncPolicy fsyncPolicy = static_cast<Downloader::FsyncPolicy>(COVERART_FSYNC_POLICY);
+
+enum SniffResult { SNIFF_MORE, SNIFF_IMAGE, SNIFF_OTHER };
+// enough leading bytes to tell every supported format apart
+static const size_t SNIFF_LENGTH = 12;
+
+// matches the leading bytes against the image formats gdk-pixbuf is built with here,
+// SNIFF_MORE until there are enough of them to decide
+static SniffResult sniffImage(const std::string& head) {
+    static const std::string signatures[] = {
+        std::string("\xFF\xD8\xFF", 3),        // jpeg
+        std::string("\x89PNG\r\n\x1A\n", 8),  // png
+        "GIF87a", "GIF89a", "BM",
+        "RIFF"                                 // webp, RIFF <size> WEBP
+    };
+    bool more = false;
+    for (const auto& signature : signatures) {
+        size_t n = std::min(signature.size(), head.size());
+        if (head.compare(0, n, signature, 0, n) != 0)
+            continue;
+        if (head.size() < signature.size() || (signature == "RIFF" && head.size() < SNIFF_LENGTH)) {
+            more = true;
+            continue;
+        }
+        if (signature != "RIFF" || head.compare(8, 4, "WEBP") == 0)
+            return SNIFF_IMAGE;
+    }
+    return more ? SNIFF_MORE : SNIFF_OTHER;
 }
 
-void Downloader::downloadFile(const std::string& url, const std::string& outputPath) {
-    std::string finalOutputPath = determineFinalOutputPath(url, outputPath);
+// temporary output file plus a running digest, so the bytes are hashed as they arrive.
+// writes are gathered in a large buffer, the file is unlinked unless it was committed
+struct Downloader::DownloadSink {
+    std::string path;
+    int fd;
+    std::vector<char> buffer;
+    off_t written = 0;
+    // from Content-Length, used to preallocate the file on the first write
+    long long expectedSize = -1;
+    bool started = false;
+    bool failed = false;
+    // set when the sink itself stopped the transfer, e.g. over the size cap
+    std::string failure;
+    long long maxBytes = 0;
+    long long received = 0;
+    // the first bytes, until they tell whether this is an image at all
+    std::string head;
+    SniffResult sniff = SNIFF_MORE;
+    // of the response the body belongs to, only 2xx bodies are kept
+    long status = 0;
+    // the temporary file still exists under path
+    bool pending = true;
+    GChecksum* checksum;
+    struct curl_slist* headers = nullptr;
+    DownloadResult result;
+
+    explicit DownloadSink(const std::string& tempPath)
+        : path(tempPath), fd(open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)),
+          checksum(g_checksum_new(G_CHECKSUM_SHA256)) {
+        buffer.reserve(DOWNLOAD_WRITE_BUFFER_SIZE);
+    }
+    ~DownloadSink() {
+        if (fd >= 0)
+            close(fd);
+        discard();
+        g_checksum_free(checksum);
+        curl_slist_free_all(headers);
+    }
 
-    CURL* curl;
-    CURLcode res;
-    curl = curl_easy_init();
-    if (curl) {
-        std::ofstream file(finalOutputPath, std::ios::binary);
-        if (!file) {
-            curl_easy_cleanup(curl);
-            throw std::runtime_error("Could not open file for writing: " + finalOutputPath);
+    bool flush() {
+        size_t offset = 0;
+        while (offset < buffer.size()) {
+            ssize_t n = write(fd, buffer.data() + offset, buffer.size() - offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+            offset += n;
         }
+        written += buffer.size();
+        buffer.clear();
+        return true;
+    }
 
-        if ((CURLE_OK != curl_easy_setopt(curl, CURLOPT_URL, url.c_str()))
-            || (CURLE_OK != curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback))
-            || (CURLE_OK != curl_easy_setopt(curl, CURLOPT_WRITEDATA, &file))
-            || (CURLE_OK != curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L))) {
-            curl_easy_cleanup(curl);
-            file.close();
-            throw std::runtime_error("curl_easy_setopt() failed!!");
+    // counts and inspects bytes before they are kept, false once the transfer should stop
+    bool accept(const void* data, size_t size) {
+        received += size;
+        if (maxBytes > 0 && received > maxBytes) {
+            failure = "larger than " + std::to_string(maxBytes) + " bytes";
+            return false;
+        }
+        if (sniff == SNIFF_MORE) {
+            head.append(static_cast<const char*>(data), std::min(size, SNIFF_LENGTH - head.size()));
+            sniff = sniffImage(head);
+            if (sniff == SNIFF_OTHER) {
+                failure = "not a supported image";
+                return false;
+            }
         }
+        return true;
+    }
 
-        print_tls_version();
-        // Enable strict SSL/TLS verification
-        if ((CURLE_OK != curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L))
-            || (CURLE_OK != curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L))) {
-            curl_easy_cleanup(curl);
-            file.close();
-            throw std::runtime_error("curl_easy_setopt() failed!!");
+    bool isImage() const {
+        return sniff == SNIFF_IMAGE;
+    }
+
+    // hashes and buffers a chunk, false once a write has failed
+    bool append(const void* data, size_t size) {
+        if (failed)
+            return false;
+        if (!accept(data, size)) {
+            failed = true;
+            return false;
+        }
+        g_checksum_update(checksum, static_cast<const guchar*>(data), size);
+        if (buffer.size() + size > buffer.capacity() && !buffer.empty() && !flush()) {
+            failed = true;
+            return false;
+        }
+        const char* bytes = static_cast<const char*>(data);
+        buffer.insert(buffer.end(), bytes, bytes + size);
+        if (buffer.size() >= buffer.capacity() && !flush()) {
+            failed = true;
+            return false;
         }
+        return true;
+    }
+
+    // flushes, trims any unused preallocation and syncs per policy, then closes
+    bool finish() {
+        bool ok = !failed && fd >= 0 && flush();
+        if (ok && started && expectedSize > written)
+            ok = (ftruncate(fd, written) == 0);
+        if (ok && fsyncPolicy != FSYNC_NONE)
+            ok = (fdatasync(fd) == 0);
+        if (fd >= 0 && close(fd) != 0)
+            ok = false;
+        fd = -1;
+        return ok;
+    }
 
-        // Specify the minimum SSL/TLS version (TLS 1.2)
-        if (CURLE_OK != curl_easy_setopt(curl, CURLOPT_SSLVERSION, CURL_SSLVERSION_TLSv1_2)) {
-            curl_easy_cleanup(curl);
-            file.close();
-            throw std::runtime_error("curl_easy_setopt() failed!!");
+    // the file only becomes visible under its final name once it is complete
+    bool commit(const std::string& finalPath) {
+        if (rename(path.c_str(), finalPath.c_str()) != 0)
+            return false;
+        pending = false;
+        if (fsyncPolicy == FSYNC_FULL) {
+            // make the rename itself durable
+            std::string dir = finalPath.substr(0, finalPath.find_last_of('/') + 1);
+            int dirFd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dirFd >= 0) {
+                fsync(dirFd);
+                close(dirFd);
+            }
         }
+        return true;
+    }
+
+    void discard() {
+        if (pending)
+            unlink(path.c_str());
+        pending = false;
+    }
+};
+
+void Downloader::setFsyncPolicy(FsyncPolicy policy) {
+    fsyncPolicy = policy;
+}
+
+Downloader::Downloader()
+    : limits_{COVERART_MAX_DOWNLOAD_SIZE, DOWNLOAD_CONNECT_TIMEOUT_MS, DOWNLOAD_TIMEOUT_MS,
+              DOWNLOAD_LOW_SPEED_LIMIT, DOWNLOAD_LOW_SPEED_TIME} {
+}
 
-        print_tls_version();
+void Downloader::setLimits(const Limits& limits) {
+    limits_ = limits;
+}
+
+static std::string trimHeaderValue(const std::string& value) {
+    size_t begin = value.find_first_not_of(" \t");
+    size_t end = value.find_last_not_of(" \t\r\n");
+    if (begin == std::string::npos)
+        return "";
+    return value.substr(begin, end - begin + 1);
+}
+
+static bool isRetryableCurlError(CURLcode res) {
+    switch (res) {
+    case CURLE_COULDNT_RESOLVE_PROXY:
+    case CURLE_COULDNT_RESOLVE_HOST:
+    case CURLE_COULDNT_CONNECT:
+    case CURLE_PARTIAL_FILE:
+    case CURLE_OPERATION_TIMEDOUT:
+    case CURLE_SSL_CONNECT_ERROR:
+    case CURLE_GOT_NOTHING:
+    case CURLE_SEND_ERROR:
+    case CURLE_RECV_ERROR:
+    case CURLE_HTTP2:
+    case CURLE_HTTP2_STREAM:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool isRetryableStatus(long code) {
+    return code == 408 || code == 429 || (code >= 500 && code != 501 && code != 505);
+}
 
-        res = curl_easy_perform(curl);
-        if (res != CURLE_OK) {
-            curl_easy_cleanup(curl);
-            file.close();
-            throw std::runtime_error("curl_easy_perform() failed: " + std::string(curl_easy_strerror(res)));
+void Downloader::setValidators(const std::string& etag, const std::string& lastModified) {
+    etag_ = etag;
+    lastModified_ = lastModified;
+}
+
+size_t Downloader::WriteCallback(void* contents, size_t size, size_t nmemb, void* userp) {
+    DownloadSink* sink = static_cast<DownloadSink*>(userp);
+    size_t totalSize = size * nmemb;
+    if (sink->failed)
+        return 0;
+    // error pages are not stored, the status alone decides the result
+    if (sink->status >= 300)
+        return totalSize;
+
+    if (!sink->started) {
+        sink->started = true;
+        // refuse an announced oversized body before a byte of it is stored
+        if (sink->maxBytes > 0 && sink->expectedSize > sink->maxBytes) {
+            sink->failure = "larger than " + std::to_string(sink->maxBytes) + " bytes";
+            sink->failed = true;
+            return 0;
         }
-        curl_easy_cleanup(curl);
-        file.close();
-        PMLOG_INFO(CONST_MODULE_MCD, "%s %s download sucess!!", __FUNCTION__, finalOutputPath.c_str());
-    } else {
+        // reserve the whole image up front, a full disk fails here instead of mid-way.
+        // fallocate rather than posix_fallocate, which would emulate it with writes
+        if (sink->expectedSize > 0 && fallocate(sink->fd, 0, 0, sink->expectedSize) != 0 && errno == ENOSPC) {
+            sink->failure = "no space for " + std::to_string(sink->expectedSize) + " bytes";
+            sink->failed = true;
+            return 0;
+        }
+    }
+
+    return sink->append(contents, totalSize) ? totalSize : 0;
+}
+
+size_t Downloader::HeaderCallback(char* buffer, size_t size, size_t nitems, void* userp) {
+    DownloadSink* sink = static_cast<DownloadSink*>(userp);
+    size_t totalSize = size * nitems;
+    std::string line(buffer, totalSize);
+
+    // a new status line after a redirect starts a fresh set of headers
+    if (line.compare(0, 5, "HTTP/") == 0) {
+        sink->result.etag.clear();
+        sink->result.lastModified.clear();
+        sink->result.maxAge = -1;
+        sink->result.noCache = false;
+        sink->expectedSize = -1;
+        size_t space = line.find(' ');
+        sink->status = (space == std::string::npos) ? 0 : strtol(line.c_str() + space + 1, nullptr, 10);
+        return totalSize;
+    }
+
+    size_t colon = line.find(':');
+    if (colon == std::string::npos)
+        return totalSize;
+    std::string name = line.substr(0, colon);
+    for (auto& c : name)
+        c = tolower(c);
+    std::string value = trimHeaderValue(line.substr(colon + 1));
+
+    if (name == "content-length") {
+        sink->expectedSize = strtoll(value.c_str(), nullptr, 10);
+    } else if (name == "etag") {
+        sink->result.etag = value;
+    } else if (name == "last-modified") {
+        sink->result.lastModified = value;
+    } else if (name == "cache-control") {
+        std::string directives = value;
+        for (auto& c : directives)
+            c = tolower(c);
+        if (directives.find("no-cache") != std::string::npos || directives.find("no-store") != std::string::npos)
+            sink->result.noCache = true;
+        size_t pos = directives.find("max-age=");
+        if (pos != std::string::npos)
+            sink->result.maxAge = strtol(directives.c_str() + pos + 8, nullptr, 10);
+    }
+    return totalSize;
+}
+
+void Downloader::downloadFile(const std::string& url, const std::string& outputPath,
+                              const CompletionCallback& onComplete) {
+    std::string finalOutputPath = determineFinalOutputPath(url, outputPath);
+    // the body goes to a side file first, a 304 or a failed transfer leaves the
+    // current file alone, and the rename never truncates content shared with
+    // other urls through hard links
+    std::string partPath = finalOutputPath + ".part";
+
+    CurlMultiEngine& engine = CurlMultiEngine::getInstance();
+    CURL* curl = engine.acquireHandle();
+    if (!curl) {
         throw std::runtime_error("Failed to initialize CURL");
     }
+
+    // the stream has to outlive this call, the transfer completes on the main loop
+    std::shared_ptr<DownloadSink> sink = std::make_shared<DownloadSink>(partPath);
+    if (sink->fd < 0) {
+        engine.releaseHandle(curl);
+        throw std::runtime_error("Could not open file for writing: " + partPath);
+    }
+    sink->maxBytes = limits_.maxBytes;
+
+    if (!etag_.empty())
+        sink->headers = curl_slist_append(sink->headers, ("If-None-Match: " + etag_).c_str());
+    if (!lastModified_.empty())
+        sink->headers = curl_slist_append(sink->headers, ("If-Modified-Since: " + lastModified_).c_str());
+
+    if ((CURLE_OK != curl_easy_setopt(curl, CURLOPT_URL, url.c_str()))
+        || (CURLE_OK != curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback))
+        || (CURLE_OK != curl_easy_setopt(curl, CURLOPT_WRITEDATA, sink.get()))
+        || (CURLE_OK != curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback))
+        || (CURLE_OK != curl_easy_setopt(curl, CURLOPT_HEADERDATA, sink.get()))
+        || (CURLE_OK != curl_easy_setopt(curl, CURLOPT_HTTPHEADER, sink->headers))
+        || (CURLE_OK != curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L))) {
+        engine.releaseHandle(curl);
+        throw std::runtime_error("curl_easy_setopt() failed!!");
+    }
+
+    // a stalled or endless response must not hold a transfer slot or fill the disk.
+    // the size cap is also enforced on the received bytes, for bodies without a length
+    if ((CURLE_OK != curl_easy_setopt(curl, CURLOPT_MAXFILESIZE_LARGE, static_cast<curl_off_t>(limits_.maxBytes)))
+        || (CURLE_OK != curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, limits_.connectTimeoutMs))
+        || (CURLE_OK != curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, limits_.timeoutMs))
+        || (CURLE_OK != curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, limits_.lowSpeedBytes))
+        || (CURLE_OK != curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, limits_.lowSpeedTime))) {
+        engine.releaseHandle(curl);
+        throw std::runtime_error("curl_easy_setopt() failed!!");
+    }
+
+    // Enable strict SSL/TLS verification
+    if ((CURLE_OK != curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L))
+        || (CURLE_OK != curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 2L))) {
+        engine.releaseHandle(curl);
+        throw std::runtime_error("curl_easy_setopt() failed!!");
+    }
+
+    // Specify the minimum SSL/TLS version (TLS 1.2)
+    if (CURLE_OK != curl_easy_setopt(curl, CURLOPT_SSLVERSION, CURL_SSLVERSION_TLSv1_2)) {
+        engine.releaseHandle(curl);
+        throw std::runtime_error("curl_easy_setopt() failed!!");
+    }
+
+    bool added = engine.addTransfer(curl,
+        [sink, finalOutputPath, onComplete](CURL* easy, CURLcode res) {
+            bool written = sink->finish();
+            DownloadResult& result = sink->result;
+            result.filePath = finalOutputPath;
+            curl_easy_getinfo(easy, CURLINFO_RESPONSE_CODE, &result.responseCode);
+            if (!sink->failure.empty()) {
+                // aborted on purpose, the same response would be refused again
+                result.error = sink->failure;
+            } else if (res != CURLE_OK) {
+                result.error = "curl transfer failed: " + std::string(curl_easy_strerror(res));
+                result.retryable = isRetryableCurlError(res);
+            } else if (!written) {
+                result.error = "write failed: " + sink->path;
+            } else if (result.responseCode == 304) {
+                result.success = true;
+                result.notModified = true;
+            } else if (result.responseCode >= 300) {
+                result.error = "http status " + std::to_string(result.responseCode);
+                result.retryable = isRetryableStatus(result.responseCode);
+            } else if (!sink->isImage()) {
+                result.error = "not a supported image";
+            } else if (!sink->commit(finalOutputPath)) {
+                result.error = "rename failed: " + finalOutputPath;
+            } else {
+                result.success = true;
+                result.contentDigest = std::string(g_checksum_get_string(sink->checksum)).substr(0, 32);
+            }
+
+            if (result.success) {
+                PMLOG_INFO(CONST_MODULE_MCD, "downloadFile %s %s", finalOutputPath.c_str(),
+                           result.notModified ? "not modified" : "download sucess!!");
+            } else {
+                PMLOG_ERROR(CONST_MODULE_MCD, "downloadFile %s %s", finalOutputPath.c_str(), result.error.c_str());
+            }
+            // drop the temporary file now, a follow-up download may reuse its name
+            sink->discard();
+            if (onComplete)
+                onComplete(result);
+        });
+    if (!added) {
+        engine.releaseHandle(curl);
+        throw std::runtime_error("Failed to start transfer");
+    }
+}
+
+void Downloader::startLocal(const std::string& url, const std::string& outputPath, const FillFunction& fill,
+                            const CompletionCallback& onComplete) {
+    // shared by all local sources, lives as long as the process
+    static GThreadPool* localPool = g_thread_pool_new(&Downloader::runLocalTransfer, nullptr,
+                                                      COVERART_LOCAL_THREADS, FALSE, nullptr);
+    if (localPool == nullptr) {
+        throw std::runtime_error("Failed to start transfer");
+    }
+    std::string finalOutputPath = determineFinalOutputPath(url, outputPath);
+    std::shared_ptr<DownloadSink> sink = std::make_shared<DownloadSink>(finalOutputPath + ".part");
+    if (sink->fd < 0) {
+        throw std::runtime_error("Could not open file for writing: " + sink->path);
+    }
+    sink->maxBytes = limits_.maxBytes;
+    // reading, copying and syncing stay off the main loop, only the result comes back to it
+    LocalTransfer* transfer = new LocalTransfer{sink, finalOutputPath, fill, onComplete};
+    if (!g_thread_pool_push(localPool, transfer, nullptr)) {
+        delete transfer;
+        throw std::runtime_error("Failed to start transfer");
+    }
+}
+
+void Downloader::runLocalTransfer(gpointer data, gpointer userData) {
+    LocalTransfer* transfer = static_cast<LocalTransfer*>(data);
+    DownloadSink& sink = *transfer->sink;
+    DownloadResult& result = sink.result;
+    result.filePath = transfer->finalOutputPath;
+
+    std::string error;
+    bool filled = transfer->fill(sink, error);
+    bool written = sink.finish();
+    if (!sink.failure.empty()) {
+        result.error = sink.failure;
+    } else if (!filled) {
+        result.error = error;
+    } else if (!written) {
+        result.error = "write failed: " + sink.path;
+    } else if (!sink.isImage()) {
+        result.error = "not a supported image";
+    } else if (!sink.commit(transfer->finalOutputPath)) {
+        result.error = "rename failed: " + transfer->finalOutputPath;
+    } else {
+        result.success = true;
+        result.contentDigest = std::string(g_checksum_get_string(sink.checksum)).substr(0, 32);
+    }
+    sink.discard();
+    g_idle_add(&Downloader::onLocalTransferDone, transfer);
+}
+
+gboolean Downloader::onLocalTransferDone(gpointer data) {
+    LocalTransfer* transfer = static_cast<LocalTransfer*>(data);
+    const DownloadResult& result = transfer->sink->result;
+    if (result.success) {
+        PMLOG_INFO(CONST_MODULE_MCD, "%s %s stored", __FUNCTION__, transfer->finalOutputPath.c_str());
+    } else {
+        PMLOG_ERROR(CONST_MODULE_MCD, "%s %s %s", __FUNCTION__, transfer->finalOutputPath.c_str(),
+                    result.error.c_str());
+    }
+    if (transfer->onComplete)
+        transfer->onComplete(result);
+    delete transfer;
+    return G_SOURCE_REMOVE;
 }
 
 std::string Downloader::determineFinalOutputPath(const std::string& url, const std::string& outputPath) {
@@ -111,6 +514,8 @@ std::string Downloader::determineFinalOutputPath(const std::string& url, const s
     } else if (info.st_mode & S_IFDIR) {
         // If outputPath is a directory
         std::string filename = extractFilenameFromUrl(url);
+        if (outputPath.back() == '/')
+            return outputPath + filename;
         return outputPath + "/" + filename;
     } else {
         // It's a file path
@@ -118,11 +523,148 @@ std::string Downloader::determineFinalOutputPath(const std::string& url, const s
     }
 }
 
-void HttpDownloader::download(const std::string& url, const std::string& outputPath) {
-    downloadFile(url, outputPath);
+void HttpDownloader::download(const std::string& url, const std::string& outputPath,
+                              const CompletionCallback& onComplete) {
+    downloadFile(url, outputPath, onComplete);
 }
 
-void HttpsDownloader::download(const std::string& url, const std::string& outputPath) {
-    downloadFile(url, outputPath);
+void HttpsDownloader::download(const std::string& url, const std::string& outputPath,
+                               const CompletionCallback& onComplete) {
+    downloadFile(url, outputPath, onComplete);
 }
 
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c = tolower(c);
+    return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
+}
+
+// percent decoding that keeps escaped NULs, g_uri_unescape_string refuses them.
+// false on a malformed escape
+static bool unescapeBytes(const std::string& text, size_t begin, std::string& decoded) {
+    decoded.reserve(text.size() - begin);
+    for (size_t pos = begin; pos < text.size(); pos++) {
+        if (text[pos] != '%') {
+            decoded += text[pos];
+            continue;
+        }
+        int high = (pos + 2 < text.size()) ? hexValue(text[pos + 1]) : -1;
+        int low = (high >= 0) ? hexValue(text[pos + 2]) : -1;
+        if (low < 0)
+            return false;
+        decoded += static_cast<char>(high << 4 | low);
+        pos += 2;
+    }
+    return true;
+}
+
+static std::vector<std::string> localRoots(std::begin(COVERART_LOCAL_ROOTS), std::end(COVERART_LOCAL_ROOTS));
+
+static bool isAllowedLocalPath(const std::string& path) {
+    for (const auto& root : localRoots) {
+        if (path.compare(0, root.size(), root) == 0)
+            return true;
+    }
+    return false;
+}
+
+void FileDownloader::setLocalRoots(const std::vector<std::string>& roots) {
+    localRoots = roots;
+}
+
+void FileDownloader::download(const std::string& url, const std::string& outputPath,
+                              const CompletionCallback& onComplete) {
+    startLocal(url, outputPath, [url](DownloadSink& sink, std::string& error) {
+        gchar* path = g_filename_from_uri(url.c_str(), nullptr, nullptr);
+        if (path == nullptr) {
+            error = "invalid file uri";
+            return false;
+        }
+        // symlinks are resolved first, so they cannot point outside the allowed roots
+        char* resolved = realpath(path, nullptr);
+        g_free(path);
+        std::string sourcePath = resolved ? resolved : "";
+        free(resolved);
+        if (sourcePath.empty() || !isAllowedLocalPath(sourcePath)) {
+            error = "file not found or not allowed";
+            return false;
+        }
+
+        int source = open(sourcePath.c_str(), O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        struct stat info;
+        if (source < 0 || fstat(source, &info) != 0 || !S_ISREG(info.st_mode)) {
+            if (source >= 0)
+                close(source);
+            error = "not a regular file: " + sourcePath;
+            return false;
+        }
+        if (sink.maxBytes > 0 && info.st_size > sink.maxBytes) {
+            close(source);
+            error = "larger than " + std::to_string(sink.maxBytes) + " bytes";
+            return false;
+        }
+
+        // a reflink shares the blocks copy on write, the source is then only read
+        // for the digest. otherwise it is copied by hand and hashed on the way, one
+        // read either way. no hard link, the app could still rewrite its file under the cache
+        bool cloned = (ioctl(sink.fd, FICLONE, source) == 0);
+        std::vector<char> chunk(DOWNLOAD_WRITE_BUFFER_SIZE);
+        bool ok = true;
+        off_t offset = 0;
+        while (ok) {
+            ssize_t n = pread(source, chunk.data(), chunk.size(), offset);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                ok = (n == 0);
+                break;
+            }
+            offset += n;
+            ok = cloned ? sink.accept(chunk.data(), n) : sink.append(chunk.data(), n);
+            if (ok && cloned)
+                g_checksum_update(sink.checksum, reinterpret_cast<const guchar*>(chunk.data()), n);
+        }
+        close(source);
+        if (!ok)
+            error = "read failed: " + sourcePath;
+        return ok;
+    }, onComplete);
+}
+
+void DataDownloader::download(const std::string& url, const std::string& outputPath,
+                              const CompletionCallback& onComplete) {
+    startLocal(url, outputPath, [url](DownloadSink& sink, std::string& error) {
+        // data:[<mediatype>][;base64],<data>
+        size_t comma = url.find(',');
+        if (url.compare(0, 5, "data:") != 0 || comma == std::string::npos) {
+            error = "malformed data uri";
+            return false;
+        }
+        std::string meta = url.substr(5, comma - 5);
+        bool base64 = (meta.size() >= 7 && meta.compare(meta.size() - 7, 7, ";base64") == 0);
+
+        if (!base64) {
+            std::string decoded;
+            if (!unescapeBytes(url, comma + 1, decoded)) {
+                error = "malformed data uri";
+                return false;
+            }
+            return sink.append(decoded.data(), decoded.size());
+        }
+
+        // decoded a chunk at a time straight into the cache file
+        const size_t chunkSize = 64 * 1024;
+        std::vector<guchar> decoded(chunkSize / 4 * 3 + 3);
+        gint state = 0;
+        guint save = 0;
+        for (size_t pos = comma + 1; pos < url.size(); pos += chunkSize) {
+            size_t length = std::min(chunkSize, url.size() - pos);
+            gsize n = g_base64_decode_step(url.c_str() + pos, length, decoded.data(), &state, &save);
+            if (!sink.append(decoded.data(), n))
+                return false;
+        }
+        return true;
+    }, onComplete);
+}
@@ -22,25 +22,124 @@
  ------------------------------------------------------------------------------*/
 #include <string>
 #include <iostream>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <glib.h>
+
+struct DownloadResult {
+    bool success = false;
+    // the server answered 304, filePath was left untouched
+    bool notModified = false;
+    long responseCode = 0;
+    std::string filePath;
+    std::string error;
+    // first 128 bits of the sha256 of the received bytes, hex encoded
+    std::string contentDigest;
+    // validators and freshness from the response headers
+    std::string etag;
+    std::string lastModified;
+    long maxAge = -1;
+    bool noCache = false;
+    // a failure that may succeed if tried again, e.g. a timeout or a 503
+    bool retryable = false;
+};
 
 class Downloader {
 public:
-    virtual void download(const std::string& url, const std::string& outputPath) = 0;
+    // invoked on the main loop once the transfer has finished
+    using CompletionCallback = std::function<void(const DownloadResult& result)>;
+
+    // how completed downloads are flushed to storage before they are renamed into place
+    enum FsyncPolicy {
+        FSYNC_NONE = 0,  // rename only, a crash may lose the file but never exposes a partial one
+        FSYNC_DATA,      // fdatasync the file before the rename
+        FSYNC_FULL       // fdatasync the file and fsync the directory after the rename
+    };
+    // defaults to COVERART_FSYNC_POLICY from the build, set it before downloads start
+    static void setFsyncPolicy(FsyncPolicy policy);
+
+    // per transfer caps, a download that breaks one is aborted and not retried,
+    // except for the timeouts. zero disables a cap
+    struct Limits {
+        long long maxBytes;
+        long connectTimeoutMs;
+        long timeoutMs;
+        // aborted when slower than lowSpeedBytes per second for lowSpeedTime seconds
+        long lowSpeedBytes;
+        long lowSpeedTime;
+    };
+
+    Downloader();
+    // starts the transfer and returns right away, throws if it could not be started
+    virtual void download(const std::string& url, const std::string& outputPath,
+                          const CompletionCallback& onComplete) = 0;
     virtual ~Downloader() {}
 
+    // validators of the cached copy, sent as If-None-Match/If-Modified-Since
+    void setValidators(const std::string& etag, const std::string& lastModified);
+    // defaults to COVERART_MAX_DOWNLOAD_SIZE and the DOWNLOAD_*_TIMEOUT_MS values
+    void setLimits(const Limits& limits);
+    const Limits& limits() const { return limits_; }
+
     static size_t WriteCallback(void* contents, size_t size, size_t nmemb, void* userp);
-    void downloadFile(const std::string& url, const std::string& outputPath);
+    static size_t HeaderCallback(char* buffer, size_t size, size_t nitems, void* userp);
+    void downloadFile(const std::string& url, const std::string& outputPath,
+                      const CompletionCallback& onComplete);
     std::string determineFinalOutputPath(const std::string& url, const std::string& outputPath);
+
+protected:
+    struct DownloadSink;
+    // fills the sink on a worker thread, returns false and sets error on failure
+    using FillFunction = std::function<bool(DownloadSink& sink, std::string& error)>;
+
+    // for sources that need no network, the result is stored the same way as a download
+    void startLocal(const std::string& url, const std::string& outputPath, const FillFunction& fill,
+                    const CompletionCallback& onComplete);
+
+    std::string etag_;
+    std::string lastModified_;
+    Limits limits_;
+
+private:
+    struct LocalTransfer {
+        std::shared_ptr<DownloadSink> sink;
+        std::string finalOutputPath;
+        FillFunction fill;
+        CompletionCallback onComplete;
+    };
+    // fills and stores on the worker, the completion is posted back to the main loop
+    static void runLocalTransfer(gpointer data, gpointer userData);
+    static gboolean onLocalTransferDone(gpointer data);
 };
 
 class HttpDownloader : public Downloader {
 public:
-    void download(const std::string& url, const std::string& outputPath) override;
+    void download(const std::string& url, const std::string& outputPath,
+                  const CompletionCallback& onComplete) override;
 };
 
 class HttpsDownloader : public Downloader {
 public:
-    void download(const std::string& url, const std::string& outputPath) override;
+    void download(const std::string& url, const std::string& outputPath,
+                  const CompletionCallback& onComplete) override;
+};
+
+// file:// sources below COVERART_LOCAL_ROOTS, cloned or copied into the cache
+class FileDownloader : public Downloader {
+public:
+    // directories files may be taken from, defaults to COVERART_LOCAL_ROOTS. each ends
+    // with a slash. set it before downloads start
+    static void setLocalRoots(const std::vector<std::string>& roots);
+    void download(const std::string& url, const std::string& outputPath,
+                  const CompletionCallback& onComplete) override;
+};
+
+// data: sources, decoded straight into the cache file
+class DataDownloader : public Downloader {
+public:
+    void download(const std::string& url, const std::string& outputPath,
+                  const CompletionCallback& onComplete) override;
 };
 
 #endif /*DOWNLOADER_H*/
@@ -29,6 +29,10 @@ std::unique_ptr<Downloader> DownloaderFactory::createDownloader(const std::strin
         return std::unique_ptr<Downloader>(new HttpDownloader());
     } else if (scheme == "https") {
         return std::unique_ptr<Downloader>(new HttpsDownloader());
+    } else if (scheme == "file") {
+        return std::unique_ptr<Downloader>(new FileDownloader());
+    } else if (scheme == "data") {
+        return std::unique_ptr<Downloader>(new DataDownloader());
     }
     // Add more schemes as needed
     else {
@@ -38,8 +42,9 @@ std::unique_ptr<Downloader> DownloaderFactory::createDownloader(const std::strin
 
 std::string DownloaderFactory::parseScheme(const std::string& uri) {
     PMLOG_INFO(CONST_MODULE_MCD, "%s IN", __FUNCTION__);
-    size_t pos = uri.find("://");
-    if (pos == std::string::npos) {
+    // data: has no authority part, so only the colon is required
+    size_t pos = uri.find(':');
+    if (pos == std::string::npos || pos == 0) {
         throw std::invalid_argument("Invalid URI: " + uri);
     }
     return uri.substr(0, pos);
@@ -17,58 +17,710 @@
 #include "CacheManager.h"
 #include "FileSystem.h"
 #include <iostream>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <unordered_set>
+#include <chrono>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
 #include "PmLogLib.h"
 #include "MediaControlTypes.h"
 
-void CacheManager::addFile(const std::string &uri, const std::string &filePath)
+// journal records, one per line with tab separated fields
+//   A uri filePath contentPath size lastAccess etag lastModified expiresAt
+//   T uri lastAccess
+//   R uri
+static const char *JOURNAL_NAME = ".cache-journal";
+static const char *JOURNAL_TMP_NAME = ".cache-journal.tmp";
+// rewrite the journal once it holds this many records per live entry
+static const size_t JOURNAL_COMPACT_FACTOR = 4;
+static const size_t MAX_JOURNAL_FIELD = 4096;
+
+#ifndef COVERART_EVICTION_POLICY
+#define COVERART_EVICTION_POLICY 1
+#endif
+
+static bool isJournalSafe(const std::string &value)
+{
+    // large data: uris stay in memory only, they are cheap to decode again
+    return value.size() <= MAX_JOURNAL_FIELD && value.find_first_of("\t\n") == std::string::npos;
+}
+
+static std::vector<std::string> splitRecord(const std::string &line)
+{
+    std::vector<std::string> fields;
+    size_t start = 0;
+    size_t pos;
+    while ((pos = line.find('\t', start)) != std::string::npos)
+    {
+        fields.push_back(line.substr(start, pos - start));
+        start = pos + 1;
+    }
+    fields.push_back(line.substr(start));
+    return fields;
+}
+
+CacheManager::CacheManager(size_t maxSize, const std::string &cacheDir)
+    : policy_(EvictionPolicy::create(static_cast<EvictionPolicy::Type>(COVERART_EVICTION_POLICY), maxSize)),
+      policyType_(static_cast<EvictionPolicy::Type>(COVERART_EVICTION_POLICY)),
+      maxSize_(maxSize),
+      budget_(maxSize),
+      cacheDir_(cacheDir.empty() || cacheDir.back() == '/' ? cacheDir : cacheDir + "/")
+{
+    // same clock the kernel stamps file times with
+    clock_gettime(CLOCK_REALTIME_COARSE, &createdAt_);
+}
+
+CacheManager::~CacheManager()
+{
+    if (journal_ != nullptr)
+        fclose(journal_);
+}
+
+bool CacheManager::addFile(const std::string &uri, const std::string &filePath, const std::string &contentPath,
+                           const std::string &etag, const std::string &lastModified, time_t expiresAt)
 {
     PMLOG_INFO(CONST_MODULE_MCFM, "%s uri : %s, filePath : %s", __FUNCTION__, uri.c_str(), filePath.c_str());
 
-    lruList.push_front(uri);
-    cache[uri] = filePath;
-    currentSize += FileSystem::getFileSize(filePath);
-    evictLRUFiles();
+    // size is taken once here, eviction and removal use the recorded value
+    size_t fileSize = FileSystem::getFileSize(filePath);
+    std::string sharedPath = contentPath.empty() ? filePath : contentPath;
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    ensureLoaded();
+    auto it = cache.find(uri);
+    if (it != cache.end())
+    {
+        // adding the same uri twice must not count its size twice
+        if (it->second.filePath == filePath && it->second.contentPath == sharedPath && it->second.size == fileSize
+            && it->second.etag == etag && it->second.lastModified == lastModified
+            && it->second.expiresAt == expiresAt)
+        {
+            touchEntry(it);
+            return true;
+        }
+        // new content for this uri, the old shared file goes once nobody uses it
+        std::string oldContentPath = it->second.contentPath;
+        std::string oldFilePath = it->second.filePath;
+        if (removeEntry(it) && oldContentPath != oldFilePath && oldContentPath != sharedPath)
+            FileSystem::deleteFile(oldContentPath);
+    }
+
+    time_t now = time(nullptr);
+    insertEntry(uri, CacheEntry{filePath, sharedPath, fileSize, lruList.end(), now, etag, lastModified, expiresAt});
+    if (isJournalSafe(uri) && isJournalSafe(filePath) && isJournalSafe(sharedPath)
+        && isJournalSafe(etag) && isJournalSafe(lastModified))
+        appendRecord("A\t" + uri + "\t" + filePath + "\t" + sharedPath + "\t" + std::to_string(fileSize) + "\t" +
+                     std::to_string(static_cast<long long>(now)) + "\t" + etag + "\t" + lastModified + "\t" +
+                     std::to_string(static_cast<long long>(expiresAt)));
+    evictLocked(uri);
+    return cache.count(uri) != 0;
 }
 
-std::string CacheManager::getFile(const std::string &uri)
+std::string CacheManager::getFile(const std::string &uri, bool updateAccess)
 {
-    if (cache.find(uri) != cache.end())
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    ensureLoaded();
+    auto it = cache.find(uri);
+    if (it == cache.end())
     {
-        PMLOG_INFO(CONST_MODULE_MCFM, "%s cache[uri]: %s", __FUNCTION__, cache[uri].c_str());
-        return cache[uri];
+        if (updateAccess)
+            policy_->onMiss(uri);
+        return "";
     }
-    return "";
+
+    PMLOG_INFO(CONST_MODULE_MCFM, "%s cache[uri]: %s", __FUNCTION__, it->second.filePath.c_str());
+    std::string filePath = it->second.filePath;
+    if (updateAccess)
+        touchEntry(it);
+    return filePath;
+}
+
+bool CacheManager::lookup(const std::string &uri, CacheLookup &entry, bool updateAccess)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    ensureLoaded();
+    auto it = cache.find(uri);
+    if (it == cache.end())
+    {
+        if (updateAccess)
+            policy_->onMiss(uri);
+        return false;
+    }
+
+    entry.filePath = it->second.filePath;
+    entry.contentPath = it->second.contentPath;
+    entry.etag = it->second.etag;
+    entry.lastModified = it->second.lastModified;
+    entry.expiresAt = it->second.expiresAt;
+    if (updateAccess)
+        touchEntry(it);
+    return true;
 }
 
 void CacheManager::updateAccessTime(const std::string &uri)
 {
-    lruList.remove(uri);
-    lruList.push_front(uri);
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    ensureLoaded();
+    auto it = cache.find(uri);
+    if (it != cache.end())
+        touchEntry(it);
 }
 
 void CacheManager::evictLRUFiles()
 {
-    PMLOG_INFO(CONST_MODULE_MCFM, "%s currentSize: %lu, MAX_SIZE : %lu", __FUNCTION__, currentSize, MAX_SIZE);
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    ensureLoaded();
+    evictLocked();
+}
 
-    // Evict files until the total size is within the limit
-    while (currentSize > MAX_SIZE)
+void CacheManager::evictLocked(const std::string &keep)
+{
+    PMLOG_INFO(CONST_MODULE_MCFM, "%s currentSize: %zu, budget : %zu", __FUNCTION__, currentSize, budget_);
+
+    // Evict files until the total size is within the limit. shared content only
+    // frees space once its last entry is gone
+    auto evictable = [this, &keep](const std::string &key) { return key != keep && pinned_.count(key) == 0; };
+    while (currentSize > budget_ && !cache.empty())
     {
-        std::string lru = lruList.back();
-        lruList.pop_back();
-        currentSize -= FileSystem::getFileSize(cache[lru]);
-        FileSystem::deleteFile(cache[lru]);
-        cache.erase(lru);
+        std::string victim = policy_->victim(evictable);
+        if (victim.empty() && !keep.empty() && pinned_.count(keep) == 0 && cache.count(keep) != 0)
+            victim = keep;
+        if (victim.empty())
+        {
+            PMLOG_INFO(CONST_MODULE_MCFM, "%s only pinned entries left, currentSize : %zu", __FUNCTION__,
+                       currentSize);
+            break;
+        }
+        auto it = cache.find(victim);
+        std::string filePath = it->second.filePath;
+        std::string contentPath = it->second.contentPath;
+        bool released = removeEntry(it);
+        evictions_++;
+        // the entry just added is still about to be handed out
+        if (victim != keep)
+            FileSystem::deleteFile(filePath);
+        if (released && contentPath != filePath)
+            FileSystem::deleteFile(contentPath);
     }
 }
 
 void CacheManager::removeFile(const std::string &uri)
 {
     PMLOG_INFO(CONST_MODULE_MCFM, "%s uri : %s", __FUNCTION__, uri.c_str());
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    ensureLoaded();
     auto it = cache.find(uri);
-    if (it != cache.end())
+    if (it == cache.end())
+        return;
+    std::string filePath = it->second.filePath;
+    std::string contentPath = it->second.contentPath;
+    // the entry's own file is left alone, but unreferenced shared content would leak
+    if (removeEntry(it) && contentPath != filePath)
+        FileSystem::deleteFile(contentPath);
+}
+
+size_t CacheManager::getCurrentSize()
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    ensureLoaded();
+    return currentSize;
+}
+
+size_t CacheManager::getEntryCount()
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    ensureLoaded();
+    return cache.size();
+}
+
+size_t CacheManager::getContentCount()
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    ensureLoaded();
+    return contents.size();
+}
+
+void CacheManager::setEvictionPolicy(EvictionPolicy::Type type)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    ensureLoaded();
+    policyType_ = type;
+    rebuildPolicy();
+    evictLocked();
+}
+
+void CacheManager::rebuildPolicy()
+{
+    // the new policy starts from recency alone, oldest first
+    policy_ = EvictionPolicy::create(policyType_, budget_);
+    for (auto itr = lruList.rbegin(); itr != lruList.rend(); ++itr)
+    {
+        const ContentRef &content = contents.find(cache.find(*itr)->second.contentPath)->second;
+        policy_->onInsert(*itr, content.chargedTo == *itr ? content.size : 0);
+    }
+}
+
+void CacheManager::setMaxSize(size_t maxSize)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    ensureLoaded();
+    maxSize_ = maxSize;
+    updateBudget();
+    evictLocked();
+}
+
+void CacheManager::setPinned(const std::unordered_set<std::string> &keys)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    ensureLoaded();
+    pinned_ = keys;
+    // entries that lost their pin may have kept the cache over budget
+    evictLocked();
+}
+
+void CacheManager::setFreeSpaceFloor(size_t floor)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    // no ensureLoaded, loading the journal evicts against the new budget anyway
+    freeSpaceFloor_ = floor;
+    updateBudget();
+    evictLocked();
+}
+
+void CacheManager::setFreeSpace(unsigned long long freeSpace)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    ensureLoaded();
+    freeSpace_ = freeSpace;
+    freeSpaceKnown_ = true;
+    updateBudget();
+    evictLocked();
+}
+
+bool CacheManager::refreshFreeSpace()
+{
+    struct statvfs info;
+    if (cacheDir_.empty() || statvfs(cacheDir_.c_str(), &info) != 0)
+        return false;
+    // f_bavail, root reserved blocks are no use to this service
+    setFreeSpace(static_cast<unsigned long long>(info.f_bavail) * info.f_frsize);
+    return true;
+}
+
+CacheManager::Stats CacheManager::getStats()
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    ensureLoaded();
+    Stats stats;
+    stats.maxSize = maxSize_;
+    stats.budget = budget_;
+    stats.currentSize = currentSize;
+    stats.entries = cache.size();
+    stats.contents = contents.size();
+    stats.pinned = pinned_.size();
+    stats.freeSpace = freeSpace_;
+    stats.freeSpaceFloor = freeSpaceFloor_;
+    stats.evictions = evictions_;
+    return stats;
+}
+
+void CacheManager::updateBudget()
+{
+    // the cache may grow into free space above the floor, and gives back any shortfall
+    size_t budget = maxSize_;
+    if (freeSpaceKnown_)
+    {
+        unsigned long long usable = currentSize + freeSpace_;
+        usable = (usable > freeSpaceFloor_) ? usable - freeSpaceFloor_ : 0;
+        budget = static_cast<size_t>(std::min<unsigned long long>(maxSize_, usable));
+    }
+    if (budget == budget_)
+        return;
+    PMLOG_INFO(CONST_MODULE_MCFM, "%s budget %zu -> %zu, free space : %llu", __FUNCTION__, budget_, budget,
+               freeSpace_);
+    budget_ = budget;
+    policy_->setCapacity(budget);
+}
+
+void CacheManager::insertEntry(const std::string &uri, const CacheEntry &entry)
+{
+    auto content = contents.find(entry.contentPath);
+    if (content == contents.end())
+    {
+        content = contents.emplace(entry.contentPath, ContentRef{entry.size, 1, uri}).first;
+        currentSize += entry.size;
+    }
+    else
+    {
+        content->second.refCount++;
+    }
+    lruList.push_front(uri);
+    auto it = cache.emplace(uri, entry).first;
+    it->second.lruPos = lruList.begin();
+    // shared content is already charged to the entry that brought it
+    policy_->onInsert(uri, content->second.chargedTo == uri ? entry.size : 0);
+}
+
+bool CacheManager::removeEntry(std::unordered_map<std::string, CacheEntry>::iterator it)
+{
+    // state first, appending may compact the journal from the current entries
+    std::string uri = it->first;
+    bool released = false;
+    std::string heir;
+    auto content = contents.find(it->second.contentPath);
+    if (content != contents.end() && --content->second.refCount == 0)
+    {
+        currentSize -= content->second.size;
+        contents.erase(content);
+        released = true;
+    }
+    else if (content != contents.end() && content->second.chargedTo == uri)
+    {
+        // pass the size on to another entry still holding the content
+        for (const auto &other : cache)
+        {
+            if (other.first != uri && other.second.contentPath == content->first)
+            {
+                heir = other.first;
+                break;
+            }
+        }
+        content->second.chargedTo = heir;
+    }
+    lruList.erase(it->second.lruPos);
+    cache.erase(it);
+    policy_->onRemove(uri);
+    if (!heir.empty())
+        policy_->onResize(heir, content->second.size);
+    if (isJournalSafe(uri))
+        appendRecord("R\t" + uri);
+    return released;
+}
+
+void CacheManager::touchEntry(std::unordered_map<std::string, CacheEntry>::iterator it)
+{
+    lruList.splice(lruList.begin(), lruList, it->second.lruPos);
+    policy_->onAccess(it->first);
+    time_t now = time(nullptr);
+    // access order only matters at second granularity across restarts
+    if (it->second.lastAccess == now)
+        return;
+    it->second.lastAccess = now;
+    if (isJournalSafe(it->first))
+        appendRecord("T\t" + it->first + "\t" + std::to_string(static_cast<long long>(now)));
+}
+
+void CacheManager::load()
+{
+    auto begin = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if (loaded_ || loadStarted_)
+            return;
+        loadStarted_ = true;
+        loading_ = true;
+    }
+
+    // the slow part, reading the journal and checking every file, runs unlocked
+    JournalEntries entries;
+    std::vector<std::string> orphans;
+    if (!cacheDir_.empty())
+    {
+        readJournal(entries);
+        reconcileDirectory(entries, &orphans);
+    }
+    std::string records;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        mergeEntries(entries);
+        records = journalSnapshot();
+        pendingRecords_.clear();
+    }
+    // so is the journal rewrite and its fsync, the journal stays closed meanwhile
+    if (!cacheDir_.empty())
+        writeJournal(records);
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        if (!cacheDir_.empty())
+            openJournal();
+        loading_ = false;
+        loaded_ = true;
+    }
+    auto indexed = std::chrono::steady_clock::now();
+
+    // a download may have reused a name meanwhile, only files older than this cache go
+    for (const auto &orphan : orphans)
+    {
+        std::string path = cacheDir_ + orphan;
+        struct stat info;
+        if (stat(path.c_str(), &info) == 0 && isFromEarlierRun(info))
+            unlink(path.c_str());
+    }
+    PMLOG_INFO(CONST_MODULE_MCFM, "%s index ready in %lld ms, %zu unindexed files removed in %lld ms", __FUNCTION__,
+               static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(indexed - begin).count()),
+               orphans.size(),
+               static_cast<long long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                   std::chrono::steady_clock::now() - indexed).count()));
+}
+
+void CacheManager::deferLoad()
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    if (!loaded_)
+        loading_ = true;
+}
+
+void CacheManager::setCompactor(const std::function<void()> &schedule)
+{
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    compactor_ = schedule;
+}
+
+void CacheManager::compact()
+{
+    std::string records;
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        compactScheduled_ = false;
+        // not open while load() is at it, that rewrites the journal anyway
+        if (journal_ == nullptr || compacting_)
+            return;
+        fclose(journal_);
+        journal_ = nullptr;
+        compacting_ = true;
+        records = journalSnapshot();
+        pendingRecords_.clear();
+    }
+    writeJournal(records);
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        openJournal();
+        compacting_ = false;
+    }
+}
+
+void CacheManager::ensureLoaded()
+{
+    if (loaded_ || loading_)
+        return;
+    loaded_ = true;
+    if (cacheDir_.empty())
+        return;
+
+    JournalEntries entries;
+    readJournal(entries);
+    reconcileDirectory(entries, nullptr);
+    mergeEntries(entries);
+    compactJournal();
+}
+
+void CacheManager::readJournal(JournalEntries &entries) const
+{
+    std::unordered_map<std::string, CacheEntry> records;
+    std::ifstream input(cacheDir_ + JOURNAL_NAME);
+    std::string line;
+    while (std::getline(input, line))
+    {
+        std::vector<std::string> fields = splitRecord(line);
+        try {
+            if (fields[0] == "A" && fields.size() == 9)
+                records[fields[1]] = CacheEntry{fields[2], fields[3], std::stoul(fields[4]), {},
+                                                static_cast<time_t>(std::stoll(fields[5])), fields[6], fields[7],
+                                                static_cast<time_t>(std::stoll(fields[8]))};
+            else if (fields[0] == "T" && fields.size() == 3 && records.count(fields[1]))
+                records[fields[1]].lastAccess = static_cast<time_t>(std::stoll(fields[2]));
+            else if (fields[0] == "R" && fields.size() == 2)
+                records.erase(fields[1]);
+        } catch (...) {
+            // a torn last line after a crash, everything before it is still good
+            PMLOG_ERROR(CONST_MODULE_MCFM, "%s skipping malformed record", __FUNCTION__);
+        }
+    }
+
+    for (auto &record : records)
+    {
+        const CacheEntry &entry = record.second;
+        if (!FileSystem::fileExists(entry.filePath) || FileSystem::getFileSize(entry.filePath) != entry.size
+            || !FileSystem::fileExists(entry.contentPath))
+        {
+            PMLOG_INFO(CONST_MODULE_MCFM, "%s dropping stale entry : %s", __FUNCTION__, record.first.c_str());
+            continue;
+        }
+        entries.emplace_back(record.first, entry);
+    }
+    std::stable_sort(entries.begin(), entries.end(),
+                     [](const std::pair<std::string, CacheEntry> &a, const std::pair<std::string, CacheEntry> &b) {
+                         return a.second.lastAccess < b.second.lastAccess;
+                     });
+}
+
+void CacheManager::mergeEntries(const JournalEntries &entries)
+{
+    // oldest first, so the most recent entry ends up at the front of the lru list.
+    // a uri this run already stored again keeps its new entry
+    std::vector<std::string> recent(lruList.begin(), lruList.end());
+    for (const auto &item : entries)
+    {
+        if (cache.count(item.first) == 0)
+            insertEntry(item.first, item.second);
+    }
+    if (!recent.empty())
+    {
+        for (auto itr = recent.rbegin(); itr != recent.rend(); ++itr)
+            lruList.splice(lruList.begin(), lruList, cache.find(*itr)->second.lruPos);
+        rebuildPolicy();
+    }
+
+    // the journal is not open yet, so this records nothing, compaction follows
+    evictLocked();
+    PMLOG_INFO(CONST_MODULE_MCFM, "%s entries : %zu currentSize : %zu", __FUNCTION__, cache.size(), currentSize);
+}
+
+bool CacheManager::isFromEarlierRun(const struct stat &info) const
+{
+    return info.st_mtim.tv_sec < createdAt_.tv_sec
+           || (info.st_mtim.tv_sec == createdAt_.tv_sec && info.st_mtim.tv_nsec < createdAt_.tv_nsec);
+}
+
+void CacheManager::reconcileDirectory(const JournalEntries &entries, std::vector<std::string> *orphans) const
+{
+    // what this run added is newer than this cache, it is never taken for an orphan
+    std::unordered_set<std::string> known;
+    for (const auto &entry : entries)
+    {
+        known.insert(entry.second.filePath);
+        known.insert(entry.second.contentPath);
+    }
+
+    DIR *dir = opendir(cacheDir_.c_str());
+    if (dir == nullptr)
+        return;
+
+    // files nobody indexes, left behind by a crash or an older version.
+    // anything written since this cache was created belongs to this run
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != nullptr)
+    {
+        if (strcmp(entry->d_name, JOURNAL_NAME) == 0 || strcmp(entry->d_name, JOURNAL_TMP_NAME) == 0)
+            continue;
+        struct stat info;
+        if (fstatat(dirfd(dir), entry->d_name, &info, 0) != 0 || !S_ISREG(info.st_mode))
+            continue;
+        if (!isFromEarlierRun(info))
+            continue;
+        if (known.count(cacheDir_ + entry->d_name) == 0)
+        {
+            PMLOG_INFO(CONST_MODULE_MCFM, "%s removing unindexed file : %s", __FUNCTION__, entry->d_name);
+            if (orphans != nullptr)
+                orphans->push_back(entry->d_name);
+            else
+                unlinkat(dirfd(dir), entry->d_name, 0);
+        }
+    }
+    closedir(dir);
+}
+
+void CacheManager::compactJournal()
+{
+    if (journal_ != nullptr)
+    {
+        fclose(journal_);
+        journal_ = nullptr;
+    }
+    writeJournal(journalSnapshot());
+    openJournal();
+}
+
+std::string CacheManager::journalSnapshot() const
+{
+    std::string records;
+    char numbers[64];
+    for (auto itr = lruList.rbegin(); itr != lruList.rend(); ++itr)
+    {
+        const CacheEntry &entry = cache.find(*itr)->second;
+        if (!isJournalSafe(*itr) || !isJournalSafe(entry.filePath) || !isJournalSafe(entry.contentPath)
+            || !isJournalSafe(entry.etag) || !isJournalSafe(entry.lastModified))
+            continue;
+        snprintf(numbers, sizeof(numbers), "%zu\t%lld", entry.size, static_cast<long long>(entry.lastAccess));
+        records += "A\t" + *itr + "\t" + entry.filePath + "\t" + entry.contentPath + "\t" + numbers + "\t" +
+                   entry.etag + "\t" + entry.lastModified + "\t" +
+                   std::to_string(static_cast<long long>(entry.expiresAt)) + "\n";
+    }
+    return records;
+}
+
+bool CacheManager::writeJournal(const std::string &records) const
+{
+    std::string journalPath = cacheDir_ + JOURNAL_NAME;
+    std::string tmpPath = cacheDir_ + JOURNAL_TMP_NAME;
+    FILE *output = fopen(tmpPath.c_str(), "w");
+    if (output == nullptr)
+    {
+        PMLOG_ERROR(CONST_MODULE_MCFM, "%s failed to open %s", __FUNCTION__, tmpPath.c_str());
+        return false;
+    }
+
+    bool written = (fwrite(records.data(), 1, records.size(), output) == records.size())
+                   && (fflush(output) == 0) && (fsync(fileno(output)) == 0);
+    fclose(output);
+    if (!written || rename(tmpPath.c_str(), journalPath.c_str()) != 0)
+    {
+        PMLOG_ERROR(CONST_MODULE_MCFM, "%s failed to replace %s", __FUNCTION__, journalPath.c_str());
+        unlink(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+void CacheManager::openJournal()
+{
+    std::string journalPath = cacheDir_ + JOURNAL_NAME;
+    journal_ = fopen(journalPath.c_str(), "a");
+    if (journal_ == nullptr)
+    {
+        PMLOG_ERROR(CONST_MODULE_MCFM, "%s failed to open %s", __FUNCTION__, journalPath.c_str());
+        return;
+    }
+    journalRecords_ = cache.size();
+    std::vector<std::string> pending;
+    pending.swap(pendingRecords_);
+    for (const auto &record : pending)
+        appendRecord(record);
+}
+
+void CacheManager::appendRecord(const std::string &record)
+{
+    if (journal_ == nullptr)
+    {
+        if (loading_ || compacting_)
+            pendingRecords_.push_back(record);
+        return;
+    }
+
+    fputs(record.c_str(), journal_);
+    fputc('\n', journal_);
+    // access times only order eviction after a restart, they go out with the
+    // next add or remove, or whenever stdio's buffer fills
+    if (record[0] != 'T')
+        fflush(journal_);
+    journalRecords_++;
+
+    if (journalRecords_ > JOURNAL_COMPACT_FACTOR * (cache.size() + 16) && !compactScheduled_)
     {
-        currentSize -= FileSystem::getFileSize(it->second);
-        lruList.remove(uri);
-        cache.erase(it);
+        if (compactor_)
+        {
+            compactScheduled_ = true;
+            compactor_();
+        }
+        else
+        {
+            compactJournal();
+        }
     }
 }
@@ -20,18 +20,171 @@
 
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include <list>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <cstdio>
+#include <ctime>
+#include <sys/stat.h>
+#include "EvictionPolicy.h"
 
+// index of downloaded files, evicted by an EvictionPolicy once they exceed the
+// size budget. every method takes the cache lock, so it can be used from any
+// thread. with a cache directory the index is kept in an append only journal
+// there, loaded by load() or on first use and reconciled against the files
+// actually present.
 class CacheManager {
 public:
-    void addFile(const std::string& uri, const std::string& filePath);
-    std::string getFile(const std::string& uri);
+    struct CacheLookup {
+        std::string filePath;
+        std::string contentPath;
+        std::string etag;
+        std::string lastModified;
+        time_t expiresAt = 0;
+    };
+
+    struct Stats {
+        // as configured, and what is left of it under disk pressure
+        size_t maxSize = 0;
+        size_t budget = 0;
+        size_t currentSize = 0;
+        size_t entries = 0;
+        size_t contents = 0;
+        size_t pinned = 0;
+        // last seen on the cache filesystem, 0 until it was checked
+        unsigned long long freeSpace = 0;
+        size_t freeSpaceFloor = 0;
+        unsigned long evictions = 0;
+    };
+
+    explicit CacheManager(size_t maxSize = 10 * 1024 * 1024, // 10MB
+                          const std::string& cacheDir = "");
+    ~CacheManager();
+    // loads the index now rather than on first use, meant for a background thread.
+    // the journal is read and the files checked without the lock, the result is
+    // merged in at the end. meanwhile lookups only see what this run added and
+    // never wait for the disk
+    void load();
+    // a load() call is on its way, until it is done nothing loads the index in place
+    void deferLoad();
+    // called under the lock once the journal is due for a rewrite, expected to run
+    // compact() on another thread. without one the rewrite happens in place
+    void setCompactor(const std::function<void()>& schedule);
+    // rewrites the journal from the live entries. the write and its fsync run
+    // without the lock, records made meanwhile are appended afterwards
+    void compact();
+    // contentPath is the shared content addressed file behind filePath, if any.
+    // entries with the same contentPath count its size once
+    // expiresAt is when the entry needs revalidation, 0 keeps it fresh for good.
+    // false when there was no room for it besides pinned entries, filePath is then
+    // left in place uncached for the caller to hand out, a later start removes it
+    bool addFile(const std::string& uri, const std::string& filePath, const std::string& contentPath = "",
+                 const std::string& etag = "", const std::string& lastModified = "", time_t expiresAt = 0);
+    // returns "" on a miss, a hit is moved to the front when updateAccess is set
+    std::string getFile(const std::string& uri, bool updateAccess = false);
+    // full entry including validators, false on a miss
+    bool lookup(const std::string& uri, CacheLookup& entry, bool updateAccess = true);
     void updateAccessTime(const std::string& uri);
+    // evicts per policy until the budget is met, or only pinned entries are left
     void evictLRUFiles();
     void removeFile(const std::string& uri);
+    size_t getCurrentSize();
+    size_t getEntryCount();
+    size_t getContentCount();
+    // defaults to COVERART_EVICTION_POLICY from the build, current entries are kept
+    void setEvictionPolicy(EvictionPolicy::Type type);
+    void setMaxSize(size_t maxSize);
+    // these keys are never evicted, they do not need to be cached yet
+    void setPinned(const std::unordered_set<std::string>& keys);
+    // free space the cache leaves to everyone else on its filesystem. below it the
+    // budget shrinks by the shortfall, so the cache gives space back
+    void setFreeSpaceFloor(size_t floor);
+    // free bytes on the cache filesystem, evicts if the budget shrinks
+    void setFreeSpace(unsigned long long freeSpace);
+    // statvfs of the cache directory then setFreeSpace, false without one.
+    // may block on the filesystem, better called off the main loop
+    bool refreshFreeSpace();
+    Stats getStats();
 private:
-    std::unordered_map<std::string, std::string> cache;
+    struct CacheEntry {
+        std::string filePath;
+        std::string contentPath;
+        size_t size;
+        std::list<std::string>::iterator lruPos;
+        time_t lastAccess;
+        std::string etag;
+        std::string lastModified;
+        time_t expiresAt;
+    };
+
+    struct ContentRef {
+        size_t size;
+        unsigned int refCount;
+        // the entry the eviction policy charges the size to, the others count as 0
+        std::string chargedTo;
+    };
+
+    void insertEntry(const std::string& uri, const CacheEntry& entry);
+    // returns true when this was the last entry using its content file
+    bool removeEntry(std::unordered_map<std::string, CacheEntry>::iterator it);
+    void touchEntry(std::unordered_map<std::string, CacheEntry>::iterator it);
+    void updateBudget();
+    // keep is the entry just added, it only goes when it alone exceeds the budget
+    void evictLocked(const std::string& keep = "");
+
+    using JournalEntries = std::vector<std::pair<std::string, CacheEntry>>;
+
+    // loads in place under the lock, unless load() is already at it
+    void ensureLoaded();
+    // the entries whose files are still there, oldest first. touches no cache state
+    void readJournal(JournalEntries& entries) const;
+    // orphans collects the unindexed files for the caller to unlink, without it they go right away
+    void reconcileDirectory(const JournalEntries& entries, std::vector<std::string>* orphans) const;
+    // adds the journal entries behind the ones this run already has
+    void mergeEntries(const JournalEntries& entries);
+    void rebuildPolicy();
+    // written before this cache was created, so not by this run
+    bool isFromEarlierRun(const struct stat& info) const;
+    void compactJournal();
+    // the live entries as journal records
+    std::string journalSnapshot() const;
+    // replaces the journal file, no cache state involved so it may run unlocked
+    bool writeJournal(const std::string& records) const;
+    // reopens the journal for appending, with whatever was recorded while it was closed
+    void openJournal();
+    void appendRecord(const std::string& record);
+
+    std::unordered_map<std::string, CacheEntry> cache;
+    // recency order, kept for the journal whatever the policy
     std::list<std::string> lruList;
-    const size_t MAX_SIZE = 10 * 1024 * 1024; // 10MB
+    std::unordered_map<std::string, ContentRef> contents;
+    std::unique_ptr<EvictionPolicy> policy_;
+    EvictionPolicy::Type policyType_;
+    std::unordered_set<std::string> pinned_;
+    size_t maxSize_;
+    // maxSize_ lowered to keep freeSpaceFloor_ free, what eviction works against
+    size_t budget_;
+    size_t freeSpaceFloor_ = 0;
+    unsigned long long freeSpace_ = 0;
+    bool freeSpaceKnown_ = false;
+    unsigned long evictions_ = 0;
     size_t currentSize = 0;
+    std::mutex cacheMutex;
+
+    const std::string cacheDir_;
+    struct timespec createdAt_;
+    FILE *journal_ = nullptr;
+    size_t journalRecords_ = 0;
+    // records made while load() or compact() rewrites the journal, appended once it is reopened
+    std::vector<std::string> pendingRecords_;
+    std::function<void()> compactor_;
+    bool compactScheduled_ = false;
+    bool compacting_ = false;
+    bool loaded_ = false;
+    // ensureLoaded leaves the index to load()
+    bool loading_ = false;
+    bool loadStarted_ = false;
 };
@@ -0,0 +1,119 @@
+// Copyright (c) 2024 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+#include "DownloadScheduler.h"
+#include "PmLogLib.h"
+#include "MediaControlTypes.h"
+
+DownloadScheduler::DownloadScheduler(size_t maxActiveJobs, size_t maxQueueDepth)
+    : maxQueueDepth_(maxQueueDepth)
+{
+    stats_.maxActiveJobs = maxActiveJobs;
+}
+
+bool DownloadScheduler::schedule(const Job &job, Priority priority, const std::string &key)
+{
+    if (stopped_ || queueDepth() >= maxQueueDepth_)
+    {
+        stats_.rejected++;
+        PMLOG_ERROR(CONST_MODULE_MCFM, "%s queue full, depth : %zu rejected : %lu",
+                    __FUNCTION__, queueDepth(), stats_.rejected);
+        return false;
+    }
+
+    queues_[priority].push_back(QueuedJob{key, job});
+    size_t depth = queueDepth();
+    if (depth > stats_.peakQueueDepth)
+        stats_.peakQueueDepth = depth;
+    PMLOG_INFO(CONST_MODULE_MCFM, "%s priority : %d depth : %zu active : %zu", __FUNCTION__,
+               priority, depth, stats_.activeJobs);
+    startNext();
+    return true;
+}
+
+bool DownloadScheduler::promote(const std::string &key, Priority priority)
+{
+    for (int level = priority + 1; level < PRIORITY_MAX; level++)
+    {
+        auto &queue = queues_[level];
+        for (auto itr = queue.begin(); itr != queue.end(); ++itr)
+        {
+            if (itr->key != key)
+                continue;
+            queues_[priority].push_back(std::move(*itr));
+            queue.erase(itr);
+            stats_.promoted++;
+            PMLOG_INFO(CONST_MODULE_MCFM, "%s %s from %d to %d", __FUNCTION__, key.c_str(), level, priority);
+            startNext();
+            return true;
+        }
+    }
+    return false;
+}
+
+void DownloadScheduler::release()
+{
+    if (stats_.activeJobs > 0)
+        stats_.activeJobs--;
+    stats_.completed++;
+    startNext();
+}
+
+void DownloadScheduler::shutdown()
+{
+    stopped_ = true;
+    for (auto &queue : queues_)
+        queue.clear();
+}
+
+DownloadScheduler::Stats DownloadScheduler::getStats() const
+{
+    Stats stats = stats_;
+    stats.queueDepth = queueDepth();
+    return stats;
+}
+
+void DownloadScheduler::startNext()
+{
+    while (!stopped_ && stats_.activeJobs < stats_.maxActiveJobs)
+    {
+        // keep a slot for a user facing request while prefetching
+        bool lastSlot = (stats_.maxActiveJobs > 1 && stats_.activeJobs + 1 == stats_.maxActiveJobs);
+        Job job;
+        for (int level = 0; level < PRIORITY_MAX; level++)
+        {
+            auto &queue = queues_[level];
+            if (queue.empty() || (lastSlot && level == PRIORITY_LOW))
+                continue;
+            job = std::move(queue.front().job);
+            queue.pop_front();
+            break;
+        }
+        if (!job)
+            return;
+
+        stats_.activeJobs++;
+        job();
+    }
+}
+
+size_t DownloadScheduler::queueDepth() const
+{
+    size_t depth = 0;
+    for (const auto &queue : queues_)
+        depth += queue.size();
+    return depth;
+}
@@ -0,0 +1,80 @@
+// Copyright (c) 2024 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+#ifndef DOWNLOAD_SCHEDULER_H
+#define DOWNLOAD_SCHEDULER_H
+
+/*-----------------------------------------------------------------------------
+ (File Inclusions)
+ ------------------------------------------------------------------------------*/
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+
+// limits how many cover art downloads are in flight and queues the rest in a
+// bounded priority queue. low priority work never takes the last free slot.
+// used from the main loop only.
+class DownloadScheduler {
+public:
+    enum Priority {
+        PRIORITY_HIGH = 0,
+        PRIORITY_NORMAL,
+        PRIORITY_LOW,
+        PRIORITY_MAX
+    };
+
+    struct Stats {
+        size_t queueDepth = 0;
+        size_t peakQueueDepth = 0;
+        size_t activeJobs = 0;
+        size_t maxActiveJobs = 0;
+        unsigned long completed = 0;
+        unsigned long rejected = 0;
+        unsigned long promoted = 0;
+    };
+
+    using Job = std::function<void()>;
+
+    DownloadScheduler(size_t maxActiveJobs, size_t maxQueueDepth);
+
+    // returns false if the queue is full or the scheduler is shut down.
+    // key names the job for promote()
+    bool schedule(const Job& job, Priority priority = PRIORITY_NORMAL, const std::string& key = "");
+    // moves a still queued job up to priority, false if it is not waiting at a lower one
+    bool promote(const std::string& key, Priority priority);
+    // every started job calls this exactly once when it is finished
+    void release();
+    // drops queued jobs, running ones still call release()
+    void shutdown();
+    Stats getStats() const;
+
+private:
+    void startNext();
+    size_t queueDepth() const;
+
+    struct QueuedJob {
+        std::string key;
+        Job job;
+    };
+
+    std::deque<QueuedJob> queues_[PRIORITY_MAX];
+    const size_t maxQueueDepth_;
+    bool stopped_ = false;
+    Stats stats_;
+};
+
+#endif /*DOWNLOAD_SCHEDULER_H*/
@@ -0,0 +1,317 @@
+// Copyright (c) 2024 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#include "EvictionPolicy.h"
+#include <list>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+namespace {
+
+// least recently used key goes first
+class LruPolicy : public EvictionPolicy {
+public:
+    void onInsert(const std::string &key, size_t size) override
+    {
+        order.push_front(key);
+        positions[key] = order.begin();
+    }
+
+    void onAccess(const std::string &key) override
+    {
+        auto it = positions.find(key);
+        if (it != positions.end())
+            order.splice(order.begin(), order, it->second);
+    }
+
+    void onRemove(const std::string &key) override
+    {
+        auto it = positions.find(key);
+        if (it == positions.end())
+            return;
+        order.erase(it->second);
+        positions.erase(it);
+    }
+
+    std::string victim(const Filter &evictable) override
+    {
+        for (auto it = order.rbegin(); it != order.rend(); ++it)
+        {
+            if (evictable(*it))
+                return *it;
+        }
+        return "";
+    }
+
+private:
+    std::list<std::string> order;
+    std::unordered_map<std::string, std::list<std::string>::iterator> positions;
+};
+
+// approximate access counts in a fixed amount of memory. four rows of saturating
+// 4 bit counters, a key counts as its smallest one. all counters are halved
+// once in a while, so popularity from long ago fades out
+class FrequencySketch {
+public:
+    FrequencySketch() { resize(MIN_WIDTH); }
+
+    // grows with the number of keys tracked, which forgets all counts
+    void ensureCapacity(size_t keys)
+    {
+        if (keys > width)
+            resize(width * 2);
+    }
+
+    void increment(const std::string &key)
+    {
+        uint64_t hash = spread(key);
+        for (int row = 0; row < ROWS; row++)
+        {
+            uint8_t &counter = table[row * width + index(hash, row)];
+            if (counter < MAX_COUNT)
+                counter++;
+        }
+        if (++additions >= width * SAMPLE_FACTOR)
+            age();
+    }
+
+    unsigned int frequency(const std::string &key) const
+    {
+        uint64_t hash = spread(key);
+        unsigned int count = MAX_COUNT;
+        for (int row = 0; row < ROWS; row++)
+        {
+            unsigned int counter = table[row * width + index(hash, row)];
+            if (counter < count)
+                count = counter;
+        }
+        return count;
+    }
+
+private:
+    static const int ROWS = 4;
+    static const uint8_t MAX_COUNT = 15;
+    static const size_t MIN_WIDTH = 256;
+    // counts are halved after this many increments per column
+    static const size_t SAMPLE_FACTOR = 10;
+
+    void resize(size_t newWidth)
+    {
+        width = newWidth;
+        table.assign(ROWS * width, 0);
+        additions = 0;
+    }
+
+    void age()
+    {
+        for (auto &counter : table)
+            counter >>= 1;
+        additions /= 2;
+    }
+
+    // std::hash may only be 32 bits wide here, mix it up to 64
+    static uint64_t spread(const std::string &key)
+    {
+        uint64_t hash = std::hash<std::string>()(key);
+        hash = (hash ^ (hash >> 33)) * 0xff51afd7ed558ccdULL;
+        return hash ^ (hash >> 33);
+    }
+
+    size_t index(uint64_t hash, int row) const
+    {
+        static const uint64_t SEEDS[ROWS] = {0x97cb3127ULL, 0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL,
+                                             0x9ae16a3b2f90404fULL};
+        uint64_t mixed = (hash + SEEDS[row]) * 0x9e3779b97f4a7c15ULL;
+        return static_cast<size_t>(mixed >> 32) & (width - 1);
+    }
+
+    std::vector<uint8_t> table;
+    size_t width = 0;
+    size_t additions = 0;
+};
+
+// new keys enter a small lru window. what falls out of the window moves on to the
+// probation part of the main area, while there is room there. once the main area
+// is full a window candidate only gets in by being used more often than the
+// probation entry it would displace, so a burst of art viewed once cannot push
+// out art that keeps coming back. a probation entry used again is protected
+class TinyLfuPolicy : public EvictionPolicy {
+public:
+    explicit TinyLfuPolicy(size_t capacity) { setCapacity(capacity); }
+
+    void setCapacity(size_t capacity) override
+    {
+        windowMax = capacity * WINDOW_PERCENT / 100;
+        mainMax = capacity - windowMax;
+        protectedMax = mainMax * PROTECTED_PERCENT / 100;
+    }
+
+    void onInsert(const std::string &key, size_t size) override
+    {
+        window.push_front(key);
+        nodes[key] = Node{WINDOW, window.begin(), size};
+        windowBytes += size;
+        sketch.ensureCapacity(nodes.size());
+
+        // overflow goes to the main area for free until that is full as well
+        while (windowBytes > windowMax && window.size() > 1)
+        {
+            Node &tail = nodes[window.back()];
+            if (probationBytes + protectedBytes + tail.size > mainMax)
+                break;
+            moveTo(window.back(), tail, PROBATION);
+        }
+    }
+
+    void onAccess(const std::string &key) override
+    {
+        sketch.increment(key);
+        auto it = nodes.find(key);
+        if (it == nodes.end())
+            return;
+        Node &node = it->second;
+        if (node.segment == WINDOW)
+        {
+            window.splice(window.begin(), window, node.pos);
+        }
+        else if (node.segment == PROTECTED)
+        {
+            protectedList.splice(protectedList.begin(), protectedList, node.pos);
+        }
+        else
+        {
+            moveTo(key, node, PROTECTED);
+            // the protected part keeps its share, its least recent entries get another chance
+            while (protectedBytes > protectedMax && protectedList.size() > 1)
+                moveTo(protectedList.back(), nodes[protectedList.back()], PROBATION);
+        }
+    }
+
+    void onMiss(const std::string &key) override
+    {
+        sketch.increment(key);
+    }
+
+    void onResize(const std::string &key, size_t size) override
+    {
+        auto it = nodes.find(key);
+        if (it == nodes.end())
+            return;
+        bytesOf(it->second.segment) -= it->second.size;
+        bytesOf(it->second.segment) += size;
+        it->second.size = size;
+    }
+
+    void onRemove(const std::string &key) override
+    {
+        auto it = nodes.find(key);
+        if (it == nodes.end())
+            return;
+        unlink(it->second);
+        nodes.erase(it);
+    }
+
+    std::string victim(const Filter &evictable) override
+    {
+        std::string mainVictim = lastEvictable(probation, evictable);
+        if (mainVictim.empty())
+            mainVictim = lastEvictable(protectedList, evictable);
+
+        if (windowBytes > windowMax || mainVictim.empty())
+        {
+            std::string candidate = lastEvictable(window, evictable);
+            if (candidate.empty())
+                return mainVictim;
+            if (mainVictim.empty())
+                return candidate;
+            // admission, ties go to the entry already in the main area
+            if (sketch.frequency(candidate) <= sketch.frequency(mainVictim))
+                return candidate;
+            moveTo(candidate, nodes[candidate], PROBATION);
+        }
+        return mainVictim;
+    }
+
+private:
+    static const size_t WINDOW_PERCENT = 10;
+    static const size_t PROTECTED_PERCENT = 80;
+
+    enum Segment { WINDOW, PROBATION, PROTECTED };
+    struct Node {
+        Segment segment;
+        std::list<std::string>::iterator pos;
+        size_t size;
+    };
+
+    std::list<std::string> &listOf(Segment segment)
+    {
+        return segment == WINDOW ? window : (segment == PROBATION ? probation : protectedList);
+    }
+
+    size_t &bytesOf(Segment segment)
+    {
+        return segment == WINDOW ? windowBytes : (segment == PROBATION ? probationBytes : protectedBytes);
+    }
+
+    void unlink(Node &node)
+    {
+        listOf(node.segment).erase(node.pos);
+        bytesOf(node.segment) -= node.size;
+    }
+
+    // copies the key first, it may be the list element about to be erased
+    void moveTo(std::string key, Node &node, Segment segment)
+    {
+        unlink(node);
+        std::list<std::string> &target = listOf(segment);
+        target.push_front(key);
+        node.segment = segment;
+        node.pos = target.begin();
+        bytesOf(segment) += node.size;
+    }
+
+    static std::string lastEvictable(const std::list<std::string> &list, const Filter &evictable)
+    {
+        for (auto it = list.rbegin(); it != list.rend(); ++it)
+        {
+            if (evictable(*it))
+                return *it;
+        }
+        return "";
+    }
+
+    FrequencySketch sketch;
+    std::unordered_map<std::string, Node> nodes;
+    std::list<std::string> window;
+    std::list<std::string> probation;
+    std::list<std::string> protectedList;
+    size_t windowBytes = 0;
+    size_t probationBytes = 0;
+    size_t protectedBytes = 0;
+    size_t windowMax = 0;
+    size_t mainMax = 0;
+    size_t protectedMax = 0;
+};
+
+} // namespace
+
+std::unique_ptr<EvictionPolicy> EvictionPolicy::create(Type type, size_t capacity)
+{
+    if (type == TINY_LFU)
+        return std::unique_ptr<EvictionPolicy>(new TinyLfuPolicy(capacity));
+    return std::unique_ptr<EvictionPolicy>(new LruPolicy());
+}
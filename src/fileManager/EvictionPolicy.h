@@ -0,0 +1,58 @@
+// Copyright (c) 2024 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+
+#ifndef EVICTION_POLICY_H
+#define EVICTION_POLICY_H
+
+/*-----------------------------------------------------------------------------
+ (File Inclusions)
+ ------------------------------------------------------------------------------*/
+#include <string>
+#include <memory>
+#include <functional>
+
+// decides which cache entry goes next. the cache owns the entries and the byte
+// budget, the policy only sees keys and sizes. a size is what the key adds to the
+// cache, content shared by several keys is charged to one of them. not thread
+// safe, the cache calls it under its own lock
+class EvictionPolicy {
+public:
+    enum Type {
+        LRU = 0,
+        // windowed tinylfu, a small lru window in front of a segmented lru that only
+        // admits newcomers used more often than what they would displace
+        TINY_LFU
+    };
+    // false for keys that must stay, e.g. pinned ones
+    using Filter = std::function<bool(const std::string& key)>;
+
+    static std::unique_ptr<EvictionPolicy> create(Type type, size_t capacity);
+    virtual ~EvictionPolicy() {}
+
+    virtual void setCapacity(size_t capacity) {}
+    // a new key, it starts out as the most recent one
+    virtual void onInsert(const std::string& key, size_t size) = 0;
+    virtual void onAccess(const std::string& key) = 0;
+    // the key now carries a different size, e.g. shared content passed on to it
+    virtual void onResize(const std::string& key, size_t size) {}
+    // a lookup that found nothing, only frequency aware policies count it
+    virtual void onMiss(const std::string& key) {}
+    virtual void onRemove(const std::string& key) = 0;
+    // the key to evict next, "" when every key is filtered out
+    virtual std::string victim(const Filter& evictable) = 0;
+};
+
+#endif /*EVICTION_POLICY_H*/
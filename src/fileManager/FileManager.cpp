@@ -19,64 +19,537 @@
 #include "DownloaderFactory.h"
 #include "FileSystem.h"
 #include <stdexcept>
+#include <memory>
+#include <cstdio>
+#include <ctime>
 #include <unistd.h>
+#include <fcntl.h>
 #include "Utils.h"
 #include "PmLogLib.h"
 #include "MediaControlTypes.h"
 
-std::string FileManager::getURI(const std::string &uri, const std::string &outputPath)
+#ifdef COVERART_RAW_TIER
+static const bool rawTier = true;
+#else
+static const bool rawTier = false;
+#endif
+static const char RAW_VARIANT_SUFFIX[] = ".rgba";
+// empty file cached as the variant of a source that already fits, the source is served
+static const char FITS_MARKER_SUFFIX[] = ".fits";
+
+FileManager::FileManager() : FileManager(COVERART_FILE_PATH)
 {
-    if (cacheManager.getFile(uri) != "")
+}
+
+FileManager::FileManager(const std::string &cacheDir)
+    : cacheManager(COVERART_CACHE_MAX_SIZE, cacheDir),
+      scheduler(MAX_ACTIVE_DOWNLOADS, DOWNLOAD_QUEUE_LIMIT),
+      resizer(COVERART_RESIZE_THREADS)
+{
+    cacheManager.setFreeSpaceFloor(COVERART_FREE_SPACE_FLOOR);
+    GError *error = nullptr;
+    cacheTaskPool = g_thread_pool_new(&FileManager::runCacheTask, this, 1, FALSE, &error);
+    if (cacheTaskPool == nullptr)
     {
-        std::string filePath = cacheManager.getFile(uri);
-        if (FileSystem::fileExists(filePath))
-        {
-            PMLOG_INFO(CONST_MODULE_MCFM, "fileExists: YES filePath: %s", filePath.c_str());
-            cacheManager.updateAccessTime(uri);
-            return filePath;
-        }
-        else
-        {
-            PMLOG_INFO(CONST_MODULE_MCFM, "fileExists: NO");
-            cacheManager.removeFile(uri);
-        }
+        // the cache still loads on first use and is never checked against free space
+        PMLOG_ERROR(CONST_MODULE_MCFM, "%s g_thread_pool_new failed : %s", __FUNCTION__, error ? error->message : "");
+        g_clear_error(&error);
+        return;
+    }
+    // nothing touches the disk before the service is registered and idle,
+    // lookups miss until the index is there
+    cacheManager.deferLoad();
+    cacheManager.setCompactor([this]() {
+        g_thread_pool_push(cacheTaskPool, GINT_TO_POINTER(CACHE_TASK_COMPACT), nullptr);
+    });
+    startupIdle = g_idle_add_full(G_PRIORITY_LOW, &FileManager::onStartupIdle, this, nullptr);
+    diskCheckTimer = g_timeout_add_seconds(COVERART_DISK_CHECK_INTERVAL, &FileManager::onDiskCheckTimeout, this);
+}
+
+FileManager::~FileManager()
+{
+    scheduler.shutdown();
+    if (startupIdle != 0)
+        g_source_remove(startupIdle);
+    if (diskCheckTimer != 0)
+        g_source_remove(diskCheckTimer);
+    // their callbacks point at this file manager
+    for (const auto &retry : retryTimers)
+    {
+        g_source_remove(retry.first);
+        delete retry.second;
+    }
+    for (const auto &result : pendingResults)
+    {
+        g_source_remove(result.first);
+        delete result.second;
+    }
+    // waits for a running task, they use cacheManager
+    cacheManager.setCompactor(nullptr);
+    if (cacheTaskPool != nullptr)
+        g_thread_pool_free(cacheTaskPool, TRUE, TRUE);
+}
+
+gboolean FileManager::onStartupIdle(gpointer data)
+{
+    FileManager *self = static_cast<FileManager *>(data);
+    self->startupIdle = 0;
+    g_thread_pool_push(self->cacheTaskPool, GINT_TO_POINTER(CACHE_TASK_LOAD), nullptr);
+    g_thread_pool_push(self->cacheTaskPool, GINT_TO_POINTER(CACHE_TASK_DISK_CHECK), nullptr);
+    return G_SOURCE_REMOVE;
+}
+
+gboolean FileManager::onDiskCheckTimeout(gpointer data)
+{
+    FileManager *self = static_cast<FileManager *>(data);
+    // one check at a time, a slow filesystem must not pile them up
+    if (g_thread_pool_unprocessed(self->cacheTaskPool) == 0)
+        g_thread_pool_push(self->cacheTaskPool, GINT_TO_POINTER(CACHE_TASK_DISK_CHECK), nullptr);
+    self->logStats();
+    return G_SOURCE_CONTINUE;
+}
+
+void FileManager::logStats()
+{
+    DownloadScheduler::Stats downloads = getDownloadStats();
+    CacheManager::Stats cache = getCacheStats();
+    PMLOG_DEBUG("%s downloads active : %zu/%zu queued : %zu peak : %zu completed : %lu rejected : %lu promoted : %lu",
+                __FUNCTION__, downloads.activeJobs, downloads.maxActiveJobs, downloads.queueDepth,
+                downloads.peakQueueDepth, downloads.completed, downloads.rejected, downloads.promoted);
+    PMLOG_DEBUG("%s cache size : %zu budget : %zu/%zu entries : %zu contents : %zu pinned : %zu evictions : %lu "
+                "free : %llu floor : %zu", __FUNCTION__, cache.currentSize, cache.budget, cache.maxSize,
+                cache.entries, cache.contents, cache.pinned, cache.evictions, cache.freeSpace,
+                cache.freeSpaceFloor);
+}
+
+void FileManager::runCacheTask(gpointer data, gpointer userData)
+{
+    FileManager *self = static_cast<FileManager *>(userData);
+    if (GPOINTER_TO_INT(data) == CACHE_TASK_LOAD)
+        self->cacheManager.load();
+    else if (GPOINTER_TO_INT(data) == CACHE_TASK_COMPACT)
+        self->cacheManager.compact();
+    else
+        self->cacheManager.refreshFreeSpace();
+}
+
+FileManager::CacheState FileManager::lookupCache(const std::string &uri, CacheManager::CacheLookup &entry)
+{
+    if (!cacheManager.lookup(uri, entry))
+        return CACHE_MISS;
+
+    if (!FileSystem::fileExists(entry.filePath))
+    {
+        PMLOG_INFO(CONST_MODULE_MCFM, "fileExists: NO");
+        cacheManager.removeFile(uri);
+        return CACHE_MISS;
+    }
+
+    PMLOG_INFO(CONST_MODULE_MCFM, "fileExists: YES filePath: %s", entry.filePath.c_str());
+    if (entry.expiresAt != 0 && entry.expiresAt <= time(nullptr))
+        return CACHE_STALE;
+    return CACHE_FRESH;
+}
+
+bool FileManager::requestURI(const std::string &uri, const std::string &outputPath,
+                             DownloadScheduler::Priority priority, const DownloadCallback &callback)
+{
+    CacheManager::CacheLookup cached;
+    CacheState state = lookupCache(uri, cached);
+    if (state == CACHE_FRESH)
+    {
+        postResult(callback, true, cached.filePath);
+        return true;
     }
 
-    validateURI(uri);
-    if (!urlExists(uri))
+    // single flight: later requesters for the same uri wait on the pending fetch
+    auto itr = inFlight.find(uri);
+    if (itr != inFlight.end())
+    {
+        PMLOG_INFO(CONST_MODULE_MCFM, "%s attached to pending download : %s waiters : %zu",
+                   __FUNCTION__, uri.c_str(), itr->second.size() + 1);
+        itr->second.push_back(callback);
+        // a prefetch still waiting in the queue moves up once someone needs it
+        scheduler.promote(uri, priority);
+        return true;
+    }
+    inFlight[uri].push_back(callback);
+
+    DownloadJob job;
+    job.uri = uri;
+    job.outputPath = outputPath;
+    job.priority = priority;
+    job.deadline = g_get_monotonic_time() + static_cast<gint64>(DOWNLOAD_DEADLINE_MS) * 1000;
+    job.onComplete = [this, uri](bool downloaded, const std::string &filePath) {
+        completeInFlight(uri, downloaded, filePath);
+    };
+    // a stale copy is revalidated with a conditional request instead of refetched
+    job.revalidate = (state == CACHE_STALE);
+    if (job.revalidate)
+        job.cached = cached;
+
+    bool scheduled = scheduler.schedule([this, job]() { startDownload(job); }, priority, uri);
+    if (!scheduled)
+        postResult(job.onComplete, job.revalidate, job.revalidate ? cached.filePath : "");
+    return scheduled;
+}
+
+std::string FileManager::variantBase(const CacheManager::CacheLookup &original, int maxEdge)
+{
+    // named after the content digest, "<digest>.content" becomes "<digest>_<edge>"
+    std::string base = original.contentPath;
+    size_t suffix = base.rfind(".content");
+    if (suffix != std::string::npos && suffix + 8 == base.size())
+        base.erase(suffix);
+    else
+        base = original.filePath.substr(0, original.filePath.find_last_of('.'));
+    return base + "_" + std::to_string(maxEdge);
+}
+
+bool FileManager::requestVariant(const std::string &uri, int maxEdge, const DownloadCallback &callback)
+{
+    CacheManager::CacheLookup original;
+    if (!cacheManager.lookup(uri, original, false) || !FileSystem::fileExists(original.filePath))
     {
-        throw std::runtime_error("URL not found");
+        postResult(callback, false, "");
+        return false;
     }
-    std::string targetPath = "";
-    short int attempt = 1;
-    while (attempt <= MAX_TRY) {
-      try {
-        std::unique_ptr<Downloader> downloader = DownloaderFactory::createDownloader(uri);
-        downloader->download(uri, outputPath);
-        targetPath = COVERART_FILE_PATH + extractFilenameFromUrl(uri);
-        PMLOG_INFO(CONST_MODULE_MCFM, "Downloaded successfully done : %s", targetPath.c_str());
-        break;
-      } catch (...) {
-        if (attempt == MAX_TRY)
+
+    std::string variantKey = variantBase(original, maxEdge);
+    std::string rawKey = variantKey + RAW_VARIANT_SUFFIX;
+    std::string variantPath;
+    std::string rawPath;
+    if (lookupVariant(original, maxEdge, variantPath, rawPath))
+    {
+        postResult(callback, true, variantPath);
+        return true;
+    }
+
+    auto itr = inFlight.find(variantKey);
+    if (itr != inFlight.end())
+    {
+        itr->second.push_back(callback);
+        return true;
+    }
+    inFlight[variantKey].push_back(callback);
+
+    std::string sourcePath = original.filePath;
+    bool started = resizer.resize(sourcePath, variantKey, maxEdge, rawTier,
+        [this, variantKey, rawKey, sourcePath](bool success, const std::string &outputPath,
+                                               const std::string &rawPath) {
+            if (!rawPath.empty())
+                cacheManager.addFile(rawKey, rawPath);
+            // a source that already fits is served as is, its marker is cached in place of
+            // a variant. with the raw tier the raw entry already records it
+            if (success && outputPath != sourcePath)
+                cacheManager.addFile(variantKey, outputPath);
+            else if (success && rawPath.empty())
+                cacheManager.addFile(variantKey, variantKey + FITS_MARKER_SUFFIX);
+            if (!pinnedCoverArt.empty())
+                refreshPins();
+            completeInFlight(variantKey, success, outputPath);
+        });
+    if (!started)
+        postResult([this, variantKey](bool, const std::string &) { completeInFlight(variantKey, false, ""); },
+                   false, "");
+    return started;
+}
+
+static bool isFitsMarker(const std::string &path)
+{
+    size_t length = sizeof(FITS_MARKER_SUFFIX) - 1;
+    return path.size() > length && path.compare(path.size() - length, length, FITS_MARKER_SUFFIX) == 0;
+}
+
+bool FileManager::lookupVariant(const CacheManager::CacheLookup &original, int maxEdge, std::string &variantPath,
+                                std::string &rawPath)
+{
+    std::string variantKey = variantBase(original, maxEdge);
+    // raw first, so the variant stays more recent and is never evicted before it.
+    // an image that already fits only has a raw entry
+    rawPath = rawTier ? cacheManager.getFile(variantKey + RAW_VARIANT_SUFFIX, true) : "";
+    variantPath = cacheManager.getFile(variantKey, true);
+    if ((variantPath.empty() && !rawPath.empty()) || isFitsMarker(variantPath))
+        variantPath = original.filePath;
+    return !variantPath.empty() && FileSystem::fileExists(variantPath)
+           && (!rawTier || (!rawPath.empty() && FileSystem::fileExists(rawPath)));
+}
+
+bool FileManager::getCachedCoverArt(const std::string &uri, int maxEdge, CachedCoverArt &paths)
+{
+    CacheManager::CacheLookup original;
+    if (lookupCache(uri, original) != CACHE_FRESH)
+        return false;
+    if (!lookupVariant(original, maxEdge, paths.scaledPath, paths.rawPath))
+        return false;
+    paths.filePath = original.filePath;
+    return true;
+}
+
+bool FileManager::warmURI(const std::string &uri, int maxEdge)
+{
+    CacheManager::CacheLookup original;
+    if (!cacheManager.lookup(uri, original, false))
+        return false;
+
+    // readahead only, the page cache fills in the background
+    std::string base = variantBase(original, maxEdge);
+    std::string paths[] = {original.filePath, cacheManager.getFile(base), cacheManager.getFile(base + RAW_VARIANT_SUFFIX)};
+    for (const auto &path : paths)
+    {
+        if (path.empty())
+            continue;
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+            continue;
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+    return true;
+}
+
+std::string FileManager::getRawVariantPath(const std::string &uri, int maxEdge)
+{
+    CacheManager::CacheLookup original;
+    if (!rawTier || !cacheManager.lookup(uri, original, false))
+        return "";
+    std::string rawPath = cacheManager.getFile(variantBase(original, maxEdge) + RAW_VARIANT_SUFFIX);
+    return FileSystem::fileExists(rawPath) ? rawPath : "";
+}
+
+void FileManager::setPinnedCoverArt(const std::vector<std::pair<std::string, int>> &coverArt)
+{
+    pinnedCoverArt = coverArt;
+    refreshPins();
+}
+
+void FileManager::refreshPins()
+{
+    // variant names follow the content, so they are looked up again whenever it may have changed
+    std::unordered_set<std::string> keys;
+    for (const auto &coverArt : pinnedCoverArt)
+    {
+        keys.insert(coverArt.first);
+        CacheManager::CacheLookup original;
+        if (!cacheManager.lookup(coverArt.first, original, false))
+            continue;
+        std::string base = variantBase(original, coverArt.second);
+        keys.insert(base);
+        keys.insert(base + RAW_VARIANT_SUFFIX);
+    }
+    cacheManager.setPinned(keys);
+}
+
+void FileManager::startDownload(const DownloadJob &job)
+{
+    PMLOG_INFO(CONST_MODULE_MCFM, "%s uri : %s attempt : %d revalidate : %d", __FUNCTION__, job.uri.c_str(),
+               job.attempt, job.revalidate);
+    try {
+        validateURI(job.uri);
+        if (!urlExists(job.uri))
         {
-            throw std::runtime_error("Download failed");
+            throw std::runtime_error("URL not found");
         }
-        else
-            PMLOG_INFO(CONST_MODULE_MCFM, "Downloaded error trying again...");
-        attempt++;
-        sleep(2);
-      }
+        std::unique_ptr<Downloader> downloader = DownloaderFactory::createDownloader(job.uri);
+        if (job.revalidate)
+            downloader->setValidators(job.cached.etag, job.cached.lastModified);
+        // a retry gets no more time than is left before the job deadline
+        Downloader::Limits limits = downloader->limits();
+        long remainingMs = static_cast<long>((job.deadline - g_get_monotonic_time()) / 1000);
+        limits.timeoutMs = std::min(limits.timeoutMs, std::max(remainingMs, 1000L));
+        downloader->setLimits(limits);
+        downloader->download(job.uri, job.outputPath, [this, job](const DownloadResult &result) {
+            finishAttempt(job, result);
+        });
+    } catch (const std::invalid_argument &e) {
+        // bad uri or unsupported scheme, trying again cannot help
+        PMLOG_ERROR(CONST_MODULE_MCFM, "%s %s : %s", __FUNCTION__, job.uri.c_str(), e.what());
+        DownloadResult result;
+        result.error = e.what();
+        finishAttempt(job, result);
+    } catch (const std::exception &e) {
+        PMLOG_ERROR(CONST_MODULE_MCFM, "%s %s : %s", __FUNCTION__, job.uri.c_str(), e.what());
+        DownloadResult result;
+        result.error = e.what();
+        result.retryable = true;
+        finishAttempt(job, result);
     }
-    if (FileSystem::fileExists(targetPath))
+}
+
+void FileManager::finishAttempt(const DownloadJob &job, const DownloadResult &result)
+{
+    if (result.success && result.notModified && job.revalidate)
     {
-        cacheManager.addFile(uri, targetPath);
-        cacheManager.updateAccessTime(uri);
-        return targetPath;
+        PMLOG_INFO(CONST_MODULE_MCFM, "%s not modified : %s", __FUNCTION__, job.uri.c_str());
+        // a 304 may omit the validators, the stored ones stay valid then
+        DownloadResult merged = result;
+        if (merged.etag.empty())
+            merged.etag = job.cached.etag;
+        if (merged.lastModified.empty())
+            merged.lastModified = job.cached.lastModified;
+        if (!cacheManager.addFile(job.uri, job.cached.filePath, job.cached.contentPath, merged.etag,
+                                  merged.lastModified, computeExpiry(merged)))
+            PMLOG_INFO(CONST_MODULE_MCFM, "%s no room left, served uncached : %s", __FUNCTION__, job.uri.c_str());
+        scheduler.release();
+        postResult(job.onComplete, true, job.cached.filePath);
+        return;
     }
-    else
+
+    if (result.success && !result.notModified && FileSystem::fileExists(result.filePath))
+    {
+        PMLOG_INFO(CONST_MODULE_MCFM, "Downloaded successfully done : %s", result.filePath.c_str());
+        std::string contentPath = storeContent(result.filePath, result.contentDigest);
+        if (!cacheManager.addFile(job.uri, result.filePath, contentPath, result.etag, result.lastModified,
+                                  computeExpiry(result)))
+            PMLOG_INFO(CONST_MODULE_MCFM, "%s no room left, served uncached : %s", __FUNCTION__, job.uri.c_str());
+        // new content may already have variants, through another url sharing it
+        if (!pinnedCoverArt.empty())
+            refreshPins();
+        scheduler.release();
+        postResult(job.onComplete, true, result.filePath);
+        return;
+    }
+
+    scheduler.release();
+    guint delay = retryDelay(job.attempt);
+    if (result.retryable && job.attempt < MAX_TRY
+        && g_get_monotonic_time() + static_cast<gint64>(delay) * 1000 < job.deadline)
     {
-        throw std::runtime_error("Download failed");
+        // the slot is free while waiting, the retry queues up for one again
+        PMLOG_INFO(CONST_MODULE_MCFM, "%s retry %s in %u ms : %s", __FUNCTION__, job.uri.c_str(), delay,
+                   result.error.c_str());
+        DownloadJob retry = job;
+        retry.attempt++;
+        RetryContext *context = new RetryContext{this, 0, retry};
+        context->sourceId = g_timeout_add(delay, &FileManager::onRetryTimeout, context);
+        retryTimers[context->sourceId] = context;
+        return;
     }
+    failDownload(job);
+}
+
+void FileManager::failDownload(const DownloadJob &job)
+{
+    if (job.revalidate)
+    {
+        // the origin is unreachable, the stale copy is better than nothing
+        PMLOG_ERROR(CONST_MODULE_MCFM, "%s revalidation failed, serving stale : %s", __FUNCTION__, job.uri.c_str());
+        postResult(job.onComplete, true, job.cached.filePath);
+        return;
+    }
+    PMLOG_ERROR(CONST_MODULE_MCFM, "%s Download failed : %s", __FUNCTION__, job.uri.c_str());
+    postResult(job.onComplete, false, "");
+}
+
+guint FileManager::retryDelay(short int attempt)
+{
+    guint delay = RETRY_BASE_DELAY_MS;
+    for (short int i = 1; i < attempt && delay < RETRY_MAX_DELAY_MS; i++)
+        delay *= 2;
+    if (delay > RETRY_MAX_DELAY_MS)
+        delay = RETRY_MAX_DELAY_MS;
+    // jitter within the upper half so clients failing together do not retry together
+    return delay / 2 + g_random_int_range(0, delay / 2 + 1);
+}
+
+time_t FileManager::computeExpiry(const DownloadResult &result)
+{
+    time_t now = time(nullptr);
+    if (result.noCache)
+        return now;
+    if (result.maxAge >= 0)
+        return now + result.maxAge;
+    // validators but no lifetime, check back after a while
+    if (!result.etag.empty() || !result.lastModified.empty())
+        return now + COVERART_DEFAULT_FRESHNESS;
+    // nothing to revalidate with, keep it until it is evicted
+    return 0;
+}
+
+std::string FileManager::storeContent(const std::string &filePath, const std::string &contentDigest)
+{
+    if (contentDigest.empty())
+        return filePath;
+
+    // the url named file stays where callers expect it, but identical bytes
+    // from different urls share one inode behind a content addressed name
+    std::string contentPath = filePath.substr(0, filePath.find_last_of('/') + 1) + contentDigest + ".content";
+    if (!FileSystem::fileExists(contentPath))
+    {
+        if (link(filePath.c_str(), contentPath.c_str()) == 0)
+            return contentPath;
+        PMLOG_ERROR(CONST_MODULE_MCFM, "%s link failed for %s", __FUNCTION__, contentPath.c_str());
+        return filePath;
+    }
+
+    std::string linkPath = filePath + ".link";
+    unlink(linkPath.c_str());
+    if (link(contentPath.c_str(), linkPath.c_str()) == 0)
+    {
+        if (rename(linkPath.c_str(), filePath.c_str()) == 0)
+        {
+            PMLOG_INFO(CONST_MODULE_MCFM, "%s %s shares %s", __FUNCTION__, filePath.c_str(), contentPath.c_str());
+            return contentPath;
+        }
+        unlink(linkPath.c_str());
+    }
+    PMLOG_ERROR(CONST_MODULE_MCFM, "%s could not share %s", __FUNCTION__, contentPath.c_str());
+    return filePath;
+}
+
+gboolean FileManager::onRetryTimeout(gpointer data)
+{
+    RetryContext *context = static_cast<RetryContext *>(data);
+    FileManager *self = context->self;
+    DownloadJob job = context->job;
+    self->retryTimers.erase(context->sourceId);
+    delete context;
+    if (!self->scheduler.schedule([self, job]() { self->startDownload(job); }, job.priority, job.uri))
+        self->failDownload(job);
+    return G_SOURCE_REMOVE;
+}
+
+void FileManager::completeInFlight(const std::string &uri, bool downloaded, const std::string &filePath)
+{
+    auto itr = inFlight.find(uri);
+    if (itr == inFlight.end())
+        return;
+    // detach first, a callback may request the same uri again
+    std::vector<DownloadCallback> waiters = std::move(itr->second);
+    inFlight.erase(itr);
+    for (const auto &waiter : waiters)
+    {
+        if (waiter)
+            waiter(downloaded, filePath);
+    }
+}
+
+DownloadScheduler::Stats FileManager::getDownloadStats()
+{
+    return scheduler.getStats();
+}
+
+CacheManager::Stats FileManager::getCacheStats()
+{
+    return cacheManager.getStats();
+}
+
+void FileManager::postResult(const DownloadCallback &callback, bool downloaded, const std::string &filePath)
+{
+    // callbacks always run from their own main loop iteration, never inside requestURI
+    PendingResult *result = new PendingResult{this, 0, callback, downloaded, filePath};
+    result->sourceId = g_idle_add(&FileManager::onDownloadResult, result);
+    pendingResults[result->sourceId] = result;
+}
+
+gboolean FileManager::onDownloadResult(gpointer data)
+{
+    PendingResult *result = static_cast<PendingResult *>(data);
+    result->self->pendingResults.erase(result->sourceId);
+    if (result->callback)
+        result->callback(result->downloaded, result->filePath);
+    delete result;
+    return G_SOURCE_REMOVE;
 }
 
 bool FileManager::validateURI(const std::string &uri)
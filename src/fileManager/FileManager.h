@@ -17,13 +17,121 @@
 #include <string>
 #include <unordered_map>
 #include <list>
+#include <vector>
+#include <functional>
+#include <glib.h>
 #include "CacheManager.h"
+#include "DownloadScheduler.h"
+#include "Downloader.h"
+#include "ImageResizer.h"
 
 class FileManager {
 public:
-    std::string getURI(const std::string& uri, const std::string& outputPath);
+    // invoked on the main loop once a requested uri is downloaded or failed
+    using DownloadCallback = std::function<void(bool downloaded, const std::string& filePath)>;
+
+    struct CachedCoverArt {
+        std::string filePath;
+        std::string scaledPath;
+        std::string rawPath;
+    };
+
+    FileManager();
+    explicit FileManager(const std::string& cacheDir);
+    ~FileManager();
+    bool requestURI(const std::string& uri, const std::string& outputPath,
+                    DownloadScheduler::Priority priority, const DownloadCallback& callback);
+    // a copy of the cached uri scaled to fit maxEdge, or the cached file itself if it
+    // already fits. variants are cached per content, so urls sharing content share them
+    bool requestVariant(const std::string& uri, int maxEdge, const DownloadCallback& callback);
+    // a fresh cached uri together with its variant for maxEdge, found without starting
+    // any download or resize. false means requestURI and requestVariant are needed
+    bool getCachedCoverArt(const std::string& uri, int maxEdge, CachedCoverArt& paths);
+    // asks the kernel to read the cached uri and its variant for maxEdge ahead of use.
+    // false when the uri is not cached
+    bool warmURI(const std::string& uri, int maxEdge);
+    // decoded rgba copy of that variant, "" unless the raw tier is built in and it is cached
+    std::string getRawVariantPath(const std::string& uri, int maxEdge);
+    // cover art that must survive eviction, each uri with the edge its variant is
+    // shown at. replaces the previous set
+    void setPinnedCoverArt(const std::vector<std::pair<std::string, int>>& coverArt);
+    // also logged at debug level with every disk check
+    DownloadScheduler::Stats getDownloadStats();
+    CacheManager::Stats getCacheStats();
 private:
+    struct PendingResult {
+        FileManager *self;
+        guint sourceId;
+        DownloadCallback callback;
+        bool downloaded;
+        std::string filePath;
+    };
+
+    enum CacheState {
+        CACHE_MISS,
+        CACHE_FRESH,
+        CACHE_STALE
+    };
+
+    struct DownloadJob {
+        std::string uri;
+        std::string outputPath;
+        short int attempt = 1;
+        // a retry queues up again at the same priority
+        DownloadScheduler::Priority priority = DownloadScheduler::PRIORITY_NORMAL;
+        // monotonic time in us after which no more attempts are made
+        gint64 deadline = 0;
+        DownloadCallback onComplete;
+        // set when a stale cached copy is being revalidated
+        bool revalidate = false;
+        CacheManager::CacheLookup cached;
+    };
+
+    struct RetryContext {
+        FileManager *self;
+        guint sourceId;
+        DownloadJob job;
+    };
+
     CacheManager cacheManager;
+    // callbacks waiting on a pending download or resize, keyed by uri or variant. main loop only
+    std::unordered_map<std::string, std::vector<DownloadCallback>> inFlight;
+    DownloadScheduler scheduler;
+    ImageResizer resizer;
+    // background work on the cache, one thread so tasks never overlap
+    enum CacheTask {
+        CACHE_TASK_LOAD = 1,   // index and orphan cleanup, queued once the main loop is idle
+        CACHE_TASK_DISK_CHECK, // free space, eviction follows there
+        CACHE_TASK_COMPACT     // journal rewrite, off the main loop
+    };
+    GThreadPool *cacheTaskPool = nullptr;
+    guint startupIdle = 0;
+    guint diskCheckTimer = 0;
+    // posted results and retry timers not yet run, removed with the file manager. main loop only
+    std::unordered_map<guint, PendingResult*> pendingResults;
+    std::unordered_map<guint, RetryContext*> retryTimers;
+    std::vector<std::pair<std::string, int>> pinnedCoverArt;
+    CacheState lookupCache(const std::string& uri, CacheManager::CacheLookup& entry);
+    void startDownload(const DownloadJob& job);
+    void finishAttempt(const DownloadJob& job, const DownloadResult& result);
+    // no more attempts, called once the slot has been released
+    void failDownload(const DownloadJob& job);
+    static time_t computeExpiry(const DownloadResult& result);
+    static guint retryDelay(short int attempt);
+    bool lookupVariant(const CacheManager::CacheLookup& original, int maxEdge, std::string& variantPath,
+                       std::string& rawPath);
+    static std::string variantBase(const CacheManager::CacheLookup& original, int maxEdge);
+    // pins the pinned uris together with their current variants
+    void refreshPins();
+    std::string storeContent(const std::string& filePath, const std::string& contentDigest);
+    static gboolean onRetryTimeout(gpointer data);
+    static gboolean onStartupIdle(gpointer data);
+    static gboolean onDiskCheckTimeout(gpointer data);
+    void logStats();
+    static void runCacheTask(gpointer data, gpointer userData);
+    void completeInFlight(const std::string& uri, bool downloaded, const std::string& filePath);
+    void postResult(const DownloadCallback& callback, bool downloaded, const std::string& filePath);
+    static gboolean onDownloadResult(gpointer data);
     bool validateURI(const std::string& uri);
     bool urlExists(const std::string& uri);
 };
@@ -0,0 +1,195 @@
+// Copyright (c) 2024 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+#include "ImageResizer.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include "PmLogLib.h"
+#include "MediaControlTypes.h"
+
+ImageResizer::ImageResizer(int maxThreads)
+{
+    GError *error = nullptr;
+    pool_ = g_thread_pool_new(&ImageResizer::runTask, this, maxThreads, FALSE, &error);
+    if (pool_ == nullptr)
+    {
+        PMLOG_ERROR(CONST_MODULE_MCFM, "%s g_thread_pool_new failed : %s", __FUNCTION__,
+                    error ? error->message : "");
+        g_clear_error(&error);
+    }
+}
+
+ImageResizer::~ImageResizer()
+{
+    // lets running tasks finish, then drops the results they posted, their
+    // callbacks point at the owner going away with the resizer
+    if (pool_ != nullptr)
+        g_thread_pool_free(pool_, TRUE, TRUE);
+    for (Task *task : done_)
+    {
+        g_source_remove(task->sourceId);
+        delete task;
+    }
+}
+
+bool ImageResizer::resize(const std::string &sourcePath, const std::string &outputBase, int maxEdge, bool withRaw,
+                          const ResizeCallback &callback)
+{
+    if (pool_ == nullptr)
+        return false;
+    Task *task = new Task;
+    task->owner = this;
+    task->sourcePath = sourcePath;
+    task->outputBase = outputBase;
+    task->maxEdge = maxEdge;
+    task->withRaw = withRaw;
+    task->callback = callback;
+    if (!g_thread_pool_push(pool_, task, nullptr))
+    {
+        delete task;
+        return false;
+    }
+    return true;
+}
+
+void ImageResizer::runTask(gpointer data, gpointer userData)
+{
+    Task *task = static_cast<Task *>(data);
+    int width = 0;
+    int height = 0;
+    if (gdk_pixbuf_get_file_info(task->sourcePath.c_str(), &width, &height) == nullptr)
+    {
+        PMLOG_ERROR(CONST_MODULE_MCFM, "%s unknown image format : %s", __FUNCTION__, task->sourcePath.c_str());
+        task->owner->postDone(task);
+        return;
+    }
+
+    bool fits = (width <= task->maxEdge && height <= task->maxEdge);
+    if (fits && !task->withRaw)
+    {
+        int marker = open((task->outputBase + ".fits").c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (marker >= 0)
+            close(marker);
+        task->success = true;
+        task->outputPath = task->sourcePath;
+        task->owner->postDone(task);
+        return;
+    }
+
+    // the jpeg loader decodes straight at 1/2, 1/4 or 1/8 scale when the target
+    // allows it, so a large image is never fully decoded just to be shrunk
+    GError *error = nullptr;
+    GdkPixbuf *pixbuf = fits ? gdk_pixbuf_new_from_file(task->sourcePath.c_str(), &error)
+                             : gdk_pixbuf_new_from_file_at_scale(task->sourcePath.c_str(), task->maxEdge,
+                                                                 task->maxEdge, TRUE, &error);
+    if (pixbuf == nullptr)
+    {
+        PMLOG_ERROR(CONST_MODULE_MCFM, "%s decode failed : %s %s", __FUNCTION__, task->sourcePath.c_str(),
+                    error ? error->message : "");
+        g_clear_error(&error);
+        task->owner->postDone(task);
+        return;
+    }
+
+    bool alpha = gdk_pixbuf_get_has_alpha(pixbuf);
+    std::string outputPath = fits ? task->sourcePath : task->outputBase + (alpha ? ".png" : ".jpg");
+    if (!fits)
+    {
+        std::string tempPath = outputPath + ".part";
+        gboolean saved = alpha ? gdk_pixbuf_save(pixbuf, tempPath.c_str(), "png", &error, NULL)
+                               : gdk_pixbuf_save(pixbuf, tempPath.c_str(), "jpeg", &error, "quality", "90", NULL);
+        if (!saved || rename(tempPath.c_str(), outputPath.c_str()) != 0)
+        {
+            PMLOG_ERROR(CONST_MODULE_MCFM, "%s save failed : %s %s", __FUNCTION__, outputPath.c_str(),
+                        error ? error->message : "");
+            g_clear_error(&error);
+            remove(tempPath.c_str());
+            g_object_unref(pixbuf);
+            task->owner->postDone(task);
+            return;
+        }
+        PMLOG_INFO(CONST_MODULE_MCFM, "%s %dx%d -> %s", __FUNCTION__, width, height, outputPath.c_str());
+    }
+    task->success = true;
+    task->outputPath = outputPath;
+
+    // the raw copy is optional, the encoded variant is still good without it
+    std::string rawPath = task->outputBase + ".rgba";
+    if (task->withRaw && writeRaw(pixbuf, rawPath))
+        task->rawPath = rawPath;
+    g_object_unref(pixbuf);
+    task->owner->postDone(task);
+}
+
+bool ImageResizer::writeRaw(GdkPixbuf *pixbuf, const std::string &rawPath)
+{
+    GdkPixbuf *rgba = gdk_pixbuf_get_has_alpha(pixbuf) ? pixbuf : gdk_pixbuf_add_alpha(pixbuf, FALSE, 0, 0, 0);
+    if (rgba == nullptr)
+        return false;
+
+    RawImageHeader header;
+    memcpy(header.magic, "MCSR", 4);
+    header.version = 1;
+    header.width = gdk_pixbuf_get_width(rgba);
+    header.height = gdk_pixbuf_get_height(rgba);
+    header.stride = header.width * 4;
+    header.dataOffset = sizeof(RawImageHeader);
+
+    // pixbuf rows may be padded, the file always uses the tight stride
+    std::string tempPath = rawPath + ".part";
+    FILE *file = fopen(tempPath.c_str(), "wb");
+    bool ok = (file != nullptr && fwrite(&header, sizeof(header), 1, file) == 1);
+    const guint8 *pixels = gdk_pixbuf_read_pixels(rgba);
+    int rowstride = gdk_pixbuf_get_rowstride(rgba);
+    for (uint32_t row = 0; ok && row < header.height; row++)
+        ok = (fwrite(pixels + static_cast<size_t>(row) * rowstride, header.stride, 1, file) == 1);
+    if (file != nullptr && fclose(file) != 0)
+        ok = false;
+    if (rgba != pixbuf)
+        g_object_unref(rgba);
+
+    if (!ok || rename(tempPath.c_str(), rawPath.c_str()) != 0)
+    {
+        PMLOG_ERROR(CONST_MODULE_MCFM, "%s write failed : %s", __FUNCTION__, rawPath.c_str());
+        remove(tempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+void ImageResizer::postDone(Task *task)
+{
+    // held while attaching, so onTaskDone cannot run before the task is recorded
+    std::lock_guard<std::mutex> lock(doneMutex_);
+    task->sourceId = g_idle_add(&ImageResizer::onTaskDone, task);
+    done_.insert(task);
+}
+
+gboolean ImageResizer::onTaskDone(gpointer data)
+{
+    Task *task = static_cast<Task *>(data);
+    {
+        std::lock_guard<std::mutex> lock(task->owner->doneMutex_);
+        task->owner->done_.erase(task);
+    }
+    if (task->callback)
+        task->callback(task->success, task->outputPath, task->rawPath);
+    delete task;
+    return G_SOURCE_REMOVE;
+}
@@ -0,0 +1,91 @@
+// Copyright (c) 2024 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+#ifndef IMAGE_RESIZER_H
+#define IMAGE_RESIZER_H
+
+/*-----------------------------------------------------------------------------
+ (File Inclusions)
+ ------------------------------------------------------------------------------*/
+#include <string>
+#include <functional>
+#include <cstdint>
+#include <mutex>
+#include <unordered_set>
+#include <glib.h>
+
+typedef struct _GdkPixbuf GdkPixbuf;
+
+// layout of the ".rgba" raw variants: this header, then height rows of
+// stride bytes, 8 bits per channel in R, G, B, A order. clients can mmap
+// the file and hand the pixels at dataOffset straight to a texture upload
+struct RawImageHeader {
+    char magic[4];          // "MCSR"
+    uint32_t version;       // 1
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;        // bytes per row, width * 4
+    uint32_t dataOffset;    // sizeof(RawImageHeader)
+};
+
+// scales cover art down to display sizes on a small pool of worker threads,
+// so decoding a large image never blocks the main loop. resize() is called
+// and its callback runs on the main loop.
+class ImageResizer {
+public:
+    // outputPath is the written variant, or the source itself when it already fits.
+    // rawPath is the decoded copy when one was asked for and written
+    using ResizeCallback = std::function<void(bool success, const std::string& outputPath,
+                                              const std::string& rawPath)>;
+
+    explicit ImageResizer(int maxThreads);
+    ~ImageResizer();
+
+    // fits sourcePath into maxEdge x maxEdge keeping the aspect ratio. the variant is
+    // written to outputBase plus ".jpg", or ".png" when the image has transparency.
+    // withRaw also stores the decoded pixels as outputBase plus ".rgba". a source that
+    // already fits is not rewritten, without withRaw an empty outputBase plus ".fits"
+    // marker is written instead, so that outcome can be cached too
+    bool resize(const std::string& sourcePath, const std::string& outputBase, int maxEdge, bool withRaw,
+                const ResizeCallback& callback);
+
+private:
+    struct Task {
+        ImageResizer* owner;
+        guint sourceId = 0;
+        std::string sourcePath;
+        std::string outputBase;
+        int maxEdge;
+        bool withRaw;
+        ResizeCallback callback;
+        bool success = false;
+        std::string outputPath;
+        std::string rawPath;
+    };
+
+    static void runTask(gpointer data, gpointer userData);
+    static bool writeRaw(GdkPixbuf* pixbuf, const std::string& rawPath);
+    // hands a finished task to the main loop
+    void postDone(Task* task);
+    static gboolean onTaskDone(gpointer data);
+
+    GThreadPool* pool_;
+    // finished tasks whose callback has not run yet, dropped with the resizer
+    std::mutex doneMutex_;
+    std::unordered_set<Task*> done_;
+};
+
+#endif /*IMAGE_RESIZER_H*/
@@ -0,0 +1,440 @@
+// Copyright (c) 2024 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+/*-----------------------------------------------------------------------------*/
+#include <iostream>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "CacheManager.h"
+
+const std::string CACHE_TEST_DIR = "/tmp/mcs-cache-test/";
+const int FILE_COUNT = 64;
+const size_t FILE_SIZE = 4 * 1024;
+const int THREAD_COUNT = 8;
+const int OPERATIONS_PER_THREAD = 20000;
+
+static std::string uriOf(int i) {
+  return "http://cdn.test/cover_" + std::to_string(i) + ".jpg";
+}
+
+static std::string pathOf(int i) {
+  return CACHE_TEST_DIR + "cover_" + std::to_string(i) + ".jpg";
+}
+
+static void writeFile(int i) {
+  std::ofstream file(pathOf(i), std::ios::binary | std::ios::trunc);
+  file << std::string(FILE_SIZE, 'x');
+}
+
+/* concurrent hits, inserts, removals and evictions against one cache,
+   room for a quarter of the files so eviction runs all the time */
+int test_concurrentAccess() {
+  mkdir(CACHE_TEST_DIR.c_str(), 0755);
+  for (int i = 0; i < FILE_COUNT; i++)
+    writeFile(i);
+
+  const size_t maxSize = FILE_SIZE * FILE_COUNT / 4;
+  CacheManager cache(maxSize);
+  std::atomic<unsigned long> hits(0), misses(0), overflows(0);
+
+  auto begin = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREAD_COUNT; t++) {
+    threads.emplace_back([&, t]() {
+      std::mt19937 rng(t);
+      std::uniform_int_distribution<int> pick(0, FILE_COUNT - 1);
+      std::uniform_int_distribution<int> action(0, 9);
+      for (int n = 0; n < OPERATIONS_PER_THREAD; n++) {
+        int i = pick(rng);
+        int op = action(rng);
+        if (op < 6) {
+          if (cache.getFile(uriOf(i), true) != "")
+            hits++;
+          else
+            misses++;
+        } else if (op < 8) {
+          cache.addFile(uriOf(i), pathOf(i));
+        } else if (op < 9) {
+          cache.updateAccessTime(uriOf(i));
+        } else {
+          cache.removeFile(uriOf(i));
+        }
+        if (cache.getCurrentSize() > maxSize)
+          overflows++;
+      }
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+  double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+  size_t entries = cache.getEntryCount();
+  size_t currentSize = cache.getCurrentSize();
+  std::cout << THREAD_COUNT * OPERATIONS_PER_THREAD << " operations in " << ms << " ms, hits " << hits
+            << " misses " << misses << ", entries " << entries << " size " << currentSize << std::endl;
+
+  // evicted files are deleted from disk, so re-added ones may count as 0 bytes
+  bool consistent = (currentSize <= maxSize) && (overflows == 0) && (currentSize <= entries * FILE_SIZE);
+  std::cout << (consistent ? "PASS" : "FAIL") << std::endl;
+  return consistent ? 0 : 1;
+}
+
+/* index written by one instance is picked up by the next one,
+   removed entries stay removed and unindexed files are cleaned up */
+int test_journalReload() {
+  const std::string dir = CACHE_TEST_DIR + "journal/";
+  mkdir(CACHE_TEST_DIR.c_str(), 0755);
+  mkdir(dir.c_str(), 0755);
+  std::remove((dir + ".cache-journal").c_str());
+  auto fileOf = [&dir](int i) { return dir + "cover_" + std::to_string(i) + ".jpg"; };
+  std::ofstream(dir + "orphan.jpg") << "left over";
+
+  {
+    CacheManager cache(FILE_SIZE * 16, dir);
+    for (int i = 0; i < 4; i++) {
+      std::ofstream file(fileOf(i), std::ios::binary | std::ios::trunc);
+      file << std::string(FILE_SIZE, 'x');
+    }
+    for (int i = 0; i < 4; i++)
+      cache.addFile(uriOf(i), fileOf(i), "", "\"etag" + std::to_string(i) + "\"", "");
+    cache.removeFile(uriOf(3));
+  }
+
+  // pretend the restart happens an hour later
+  struct timespec hourAgo[2];
+  clock_gettime(CLOCK_REALTIME, &hourAgo[0]);
+  hourAgo[0].tv_sec -= 3600;
+  hourAgo[1] = hourAgo[0];
+  for (int i = 0; i < 4; i++)
+    utimensat(AT_FDCWD, fileOf(i).c_str(), hourAgo, 0);
+  utimensat(AT_FDCWD, (dir + "orphan.jpg").c_str(), hourAgo, 0);
+
+  CacheManager reloaded(FILE_SIZE * 16, dir);
+  bool pass = (reloaded.getEntryCount() == 3) && (reloaded.getCurrentSize() == 3 * FILE_SIZE)
+              && (reloaded.getFile(uriOf(0)) == fileOf(0)) && (reloaded.getFile(uriOf(3)) == "");
+  struct stat info;
+  pass = pass && (stat((dir + "orphan.jpg").c_str(), &info) != 0)
+              && (stat(fileOf(3).c_str(), &info) != 0);
+  std::cout << "journal reload : entries " << reloaded.getEntryCount() << " size "
+            << reloaded.getCurrentSize() << " " << (pass ? "PASS" : "FAIL") << std::endl;
+  return pass ? 0 : 1;
+}
+
+/* journal rewrites run on the thread the compactor hands them to, records made
+   during a rewrite are kept, and the journal stays bounded */
+int test_backgroundCompaction() {
+  const std::string dir = CACHE_TEST_DIR + "compact/";
+  const int UPDATES = 400;
+  mkdir(CACHE_TEST_DIR.c_str(), 0755);
+  mkdir(dir.c_str(), 0755);
+  std::remove((dir + ".cache-journal").c_str());
+  auto fileOf = [&dir](int i) { return dir + "cover_" + std::to_string(i) + ".jpg"; };
+  for (int i = 0; i < 4; i++)
+    std::ofstream(fileOf(i), std::ios::binary | std::ios::trunc) << std::string(FILE_SIZE, 'x');
+
+  // a rewrite may ask for the next one itself, when the records it kept push it over
+  std::vector<std::thread> compactions;
+  std::mutex compactionsMutex;
+  {
+    CacheManager cache(FILE_SIZE * 16, dir);
+    cache.setCompactor([&]() {
+      std::lock_guard<std::mutex> lock(compactionsMutex);
+      compactions.emplace_back([&cache]() { cache.compact(); });
+    });
+    // a new etag replaces the entry, two records each time
+    for (int n = 0; n < UPDATES; n++)
+      cache.addFile(uriOf(n % 4), fileOf(n % 4), "", "\"etag" + std::to_string(n) + "\"", "");
+    for (size_t i = 0;; i++) {
+      std::thread compaction;
+      {
+        std::lock_guard<std::mutex> lock(compactionsMutex);
+        if (i == compactions.size())
+          break;
+        compaction = std::move(compactions[i]);
+      }
+      compaction.join();
+    }
+  }
+
+  int lines = 0;
+  std::ifstream journal(dir + ".cache-journal");
+  for (std::string line; std::getline(journal, line);)
+    lines++;
+  CacheManager reloaded(FILE_SIZE * 16, dir);
+  CacheManager::CacheLookup last;
+  bool pass = !compactions.empty() && lines < UPDATES && reloaded.getEntryCount() == 4
+              && reloaded.lookup(uriOf((UPDATES - 1) % 4), last)
+              && last.etag == "\"etag" + std::to_string(UPDATES - 1) + "\"";
+  std::cout << "background compaction : " << compactions.size() << " rewrites, journal " << lines << " lines "
+            << (pass ? "PASS" : "FAIL") << std::endl;
+  return pass ? 0 : 1;
+}
+
+/* two urls with identical bytes share one content file, its size is
+   counted once and it is only released with the last entry. the policy is
+   charged once as well, a third file fits next to the shared one */
+int test_sharedContent() {
+  const std::string dir = CACHE_TEST_DIR + "shared/";
+  mkdir(CACHE_TEST_DIR.c_str(), 0755);
+  mkdir(dir.c_str(), 0755);
+  const std::string contentPath = dir + "content.jpg";
+
+  bool pass = true;
+  for (EvictionPolicy::Type type : {EvictionPolicy::LRU, EvictionPolicy::TINY_LFU}) {
+    // the last entry released the content, so it is written again for each policy
+    std::ofstream(contentPath, std::ios::binary | std::ios::trunc) << std::string(FILE_SIZE, 'x');
+    std::remove((dir + "a.jpg").c_str());
+    std::remove((dir + "b.jpg").c_str());
+    link(contentPath.c_str(), (dir + "a.jpg").c_str());
+    link(contentPath.c_str(), (dir + "b.jpg").c_str());
+    CacheManager cache(FILE_SIZE * 2);
+    cache.setEvictionPolicy(type);
+    cache.addFile(uriOf(0), dir + "a.jpg", contentPath);
+    cache.addFile(uriOf(1), dir + "b.jpg", contentPath);
+    pass = pass && (cache.getEntryCount() == 2) && (cache.getContentCount() == 1)
+           && (cache.getCurrentSize() == FILE_SIZE);
+    // the entry charged with the content goes, the other one carries it on
+    cache.removeFile(uriOf(0));
+    pass = pass && (cache.getCurrentSize() == FILE_SIZE);
+    writeFile(2);
+    pass = pass && cache.addFile(uriOf(2), pathOf(2)) && (cache.getEntryCount() == 2)
+           && (cache.getStats().evictions == 0);
+    cache.removeFile(uriOf(1));
+    cache.removeFile(uriOf(2));
+    pass = pass && (cache.getCurrentSize() == 0) && (cache.getContentCount() == 0);
+  }
+
+  std::remove((dir + "a.jpg").c_str());
+  std::remove((dir + "b.jpg").c_str());
+  std::cout << "shared content : " << (pass ? "PASS" : "FAIL") << std::endl;
+  return pass ? 0 : 1;
+}
+
+/* a listener keeps returning to a playlist and some favourites while browsing
+   bursts of art seen once. the same trace is replayed against each policy, a
+   miss stores the file as a download would */
+static double replayTrace(const std::vector<int> &trace, size_t maxSize, EvictionPolicy::Type type) {
+  CacheManager cache(maxSize);
+  cache.setEvictionPolicy(type);
+  unsigned long hits = 0;
+  for (int i : trace) {
+    if (cache.getFile(uriOf(i), true) != "") {
+      hits++;
+    } else {
+      writeFile(i);
+      cache.addFile(uriOf(i), pathOf(i));
+    }
+  }
+  return (double)hits / trace.size();
+}
+
+int test_traceReplay() {
+  mkdir(CACHE_TEST_DIR.c_str(), 0755);
+  const int PLAYLIST = 24;
+  const int FAVOURITES = 64;
+  std::mt19937 rng(42);
+  std::geometric_distribution<int> favourite(0.08);
+  std::vector<int> trace;
+  int oneShot = 1000;
+  for (int round = 0; round < 400; round++) {
+    // the playing track is asked for by several views
+    for (int n = 0; n < 3; n++)
+      trace.push_back(round % PLAYLIST);
+    for (int n = 0; n < 4; n++)
+      trace.push_back(100 + std::min(favourite(rng), FAVOURITES - 1));
+    if (round % 5 == 0) {
+      for (int n = 0; n < 40; n++)
+        trace.push_back(oneShot++);
+    }
+  }
+
+  const size_t maxSize = FILE_SIZE * 48;
+  double lru = replayTrace(trace, maxSize, EvictionPolicy::LRU);
+  double tinyLfu = replayTrace(trace, maxSize, EvictionPolicy::TINY_LFU);
+  for (int i = 1000; i < oneShot; i++)
+    std::remove(pathOf(i).c_str());
+  bool pass = tinyLfu >= lru;
+  std::cout << "trace replay : " << trace.size() << " requests, hit ratio lru " << lru << " tinylfu " << tinyLfu
+            << " " << (pass ? "PASS" : "FAIL") << std::endl;
+  return pass ? 0 : 1;
+}
+
+/* pinned entries outlive any amount of other traffic, the rest still fits the budget */
+int test_pinning() {
+  mkdir(CACHE_TEST_DIR.c_str(), 0755);
+  const size_t maxSize = FILE_SIZE * 8;
+  bool pass = true;
+  for (EvictionPolicy::Type type : {EvictionPolicy::LRU, EvictionPolicy::TINY_LFU}) {
+    CacheManager cache(maxSize);
+    cache.setEvictionPolicy(type);
+    cache.setPinned({uriOf(0)});
+    writeFile(0);
+    cache.addFile(uriOf(0), pathOf(0));
+    for (int round = 0; round < 4; round++) {
+      for (int i = 1; i < FILE_COUNT; i++) {
+        if (cache.getFile(uriOf(i), true) == "") {
+          writeFile(i);
+          cache.addFile(uriOf(i), pathOf(i));
+        }
+      }
+    }
+    pass = pass && (cache.getFile(uriOf(0)) == pathOf(0)) && (cache.getCurrentSize() <= maxSize);
+    // no room besides pinned entries, a newcomer is not cached but its file stays for its requester
+    cache.setMaxSize(FILE_SIZE);
+    writeFile(1);
+    struct stat info;
+    pass = pass && !cache.addFile(uriOf(1), pathOf(1)) && (cache.getFile(uriOf(1)) == "")
+                && (stat(pathOf(1).c_str(), &info) == 0);
+    cache.setMaxSize(maxSize);
+    // unpinned, it is just another old entry
+    cache.setPinned({});
+    for (int i = 1; i < FILE_COUNT; i++) {
+      writeFile(i);
+      cache.addFile(uriOf(i), pathOf(i));
+    }
+    pass = pass && (cache.getFile(uriOf(0)) == "");
+  }
+  std::cout << "pinning : " << (pass ? "PASS" : "FAIL") << std::endl;
+  return pass ? 0 : 1;
+}
+
+/* the budget shrinks by the free space missing below the floor and comes back
+   once there is room again, the real cache filesystem can be checked too */
+int test_diskPressure() {
+  const std::string dir = CACHE_TEST_DIR + "pressure/";
+  mkdir(CACHE_TEST_DIR.c_str(), 0755);
+  mkdir(dir.c_str(), 0755);
+  std::remove((dir + ".cache-journal").c_str());
+  const size_t maxSize = FILE_SIZE * 16;
+  const size_t floor = FILE_SIZE * 100;
+  CacheManager cache(maxSize, dir);
+  cache.setFreeSpaceFloor(floor);
+  for (int i = 0; i < 10; i++) {
+    writeFile(i);
+    cache.addFile(uriOf(i), pathOf(i));
+  }
+
+  // four files short of the floor
+  cache.setFreeSpace(floor - FILE_SIZE * 4);
+  CacheManager::Stats squeezed = cache.getStats();
+  cache.setFreeSpace(floor * 10);
+  CacheManager::Stats relieved = cache.getStats();
+  bool checked = cache.refreshFreeSpace();
+  CacheManager::Stats real = cache.getStats();
+
+  bool pass = (squeezed.budget == FILE_SIZE * 6) && (squeezed.currentSize <= squeezed.budget)
+              && (squeezed.evictions == 4) && (relieved.budget == maxSize) && checked && (real.freeSpace > 0)
+              && (real.budget <= maxSize);
+  std::cout << "disk pressure : budget " << squeezed.budget << " size " << squeezed.currentSize << ", relieved "
+            << relieved.budget << ", free on " << dir << " " << real.freeSpace << " budget " << real.budget
+            << " " << (pass ? "PASS" : "FAIL") << std::endl;
+  return pass ? 0 : 1;
+}
+
+/* creating the cache touches no files, a lookup while load() runs elsewhere
+   waits for the index at most and orphans from an earlier run are still removed */
+int test_backgroundLoad() {
+  const std::string dir = CACHE_TEST_DIR + "startup/";
+  const int ORPHANS = 3000;
+  mkdir(CACHE_TEST_DIR.c_str(), 0755);
+  mkdir(dir.c_str(), 0755);
+  std::remove((dir + ".cache-journal").c_str());
+  auto fileOf = [&dir](int i) { return dir + "cover_" + std::to_string(i) + ".jpg"; };
+  auto orphanOf = [&dir](int i) { return dir + "orphan_" + std::to_string(i) + ".jpg"; };
+  {
+    CacheManager cache(FILE_SIZE * 16, dir);
+    for (int i = 0; i < 4; i++) {
+      std::ofstream(fileOf(i), std::ios::binary | std::ios::trunc) << std::string(FILE_SIZE, 'x');
+      cache.addFile(uriOf(i), fileOf(i));
+    }
+  }
+  struct timespec hourAgo[2];
+  clock_gettime(CLOCK_REALTIME, &hourAgo[0]);
+  hourAgo[0].tv_sec -= 3600;
+  hourAgo[1] = hourAgo[0];
+  for (int i = 0; i < ORPHANS; i++) {
+    std::ofstream(orphanOf(i)) << "left over";
+    utimensat(AT_FDCWD, orphanOf(i).c_str(), hourAgo, 0);
+  }
+  for (int i = 0; i < 4; i++)
+    utimensat(AT_FDCWD, fileOf(i).c_str(), hourAgo, 0);
+
+  auto begin = std::chrono::steady_clock::now();
+  CacheManager cache(FILE_SIZE * 16, dir);
+  double createMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+  cache.deferLoad();
+  std::atomic<bool> indexed(false);
+  std::thread loader([&cache, &indexed]() {
+    cache.load();
+    indexed = true;
+  });
+  // lookups and a new download while the index loads, none of them may wait for it
+  std::ofstream(fileOf(100), std::ios::binary | std::ios::trunc) << std::string(FILE_SIZE, 'x');
+  double lookupMs = 0;
+  int lookups = 0;
+  bool added = false;
+  while (!indexed) {
+    if (!added) {
+      cache.addFile(uriOf(100), fileOf(100));
+      added = true;
+    }
+    auto lookupBegin = std::chrono::steady_clock::now();
+    cache.getFile(uriOf(0));
+    lookupMs = std::max(lookupMs,
+                        std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - lookupBegin).count());
+    lookups++;
+  }
+  loader.join();
+  double totalMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+  bool hit = (cache.getFile(uriOf(0)) == fileOf(0)) && (cache.getFile(uriOf(100)) == fileOf(100));
+
+  int left = 0;
+  struct stat info;
+  for (int i = 0; i < ORPHANS; i++)
+    left += (stat(orphanOf(i).c_str(), &info) == 0);
+  // the entry added during the load made it into the journal as well
+  CacheManager reloaded(FILE_SIZE * 16, dir);
+  bool journaled = (reloaded.getEntryCount() == 5) && (reloaded.getFile(uriOf(100)) == fileOf(100));
+  bool pass = (createMs < 10) && (lookupMs < 20) && hit && journaled && (cache.getEntryCount() == 5) && (left == 0);
+  std::cout << "background load : created in " << createMs << " ms, slowest of " << lookups << " lookups "
+            << lookupMs << " ms, load with " << ORPHANS << " orphans done in " << totalMs << " ms, left " << left
+            << ", journaled " << journaled << " " << (pass ? "PASS" : "FAIL") << std::endl;
+  return pass ? 0 : 1;
+}
+
+int main(int argc, char const *argv[]) {
+  int result = test_concurrentAccess();
+  result |= test_journalReload();
+  result |= test_backgroundCompaction();
+  result |= test_sharedContent();
+  result |= test_traceReplay();
+  result |= test_pinning();
+  result |= test_diskPressure();
+  result |= test_backgroundLoad();
+  return result;
+}
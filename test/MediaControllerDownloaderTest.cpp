@@ -0,0 +1,456 @@
+// Copyright (c) 2024 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+/*-----------------------------------------------------------------------------*/
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <cstdio>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <glib.h>
+#include "DownloaderFactory.h"
+#include "CurlMultiEngine.h"
+
+const int PARALLEL_FETCHES = 50;
+const size_t PAYLOAD_SIZE = 256 * 1024;
+const std::string OUTPUT_DIR = "/tmp/mcs-downloader-test/";
+const std::string PAYLOAD_ETAG = "\"cover-v1\"";
+
+/* Minimal local HTTP stand-in, answers every GET with the same jpeg payload.
+   Replies 304 to a matching If-None-Match and counts the body bytes it sends.
+   /missing answers 404, /busy answers 503 and /truncated hangs up mid-body.
+   /unbounded streams without a length, /stall stops after the first bytes
+   and /notimage answers with html */
+class LocalHttpServer {
+public:
+  bool start() {
+    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd_ < 0)
+      return false;
+    int enable = 1;
+    setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (bind(listenFd_, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || listen(listenFd_, PARALLEL_FETCHES) != 0
+        || getsockname(listenFd_, (struct sockaddr *)&addr, &len) != 0)
+      return false;
+    port_ = ntohs(addr.sin_port);
+
+    payload_.assign(PAYLOAD_SIZE, 'x');
+    payload_.replace(0, 4, "\xFF\xD8\xFF\xE0", 4);
+    std::thread(&LocalHttpServer::acceptLoop, this).detach();
+    return true;
+  }
+
+  int port() const { return port_; }
+  size_t bodyBytesSent() const { return bodyBytes_; }
+
+private:
+  void acceptLoop() {
+    while (true) {
+      int clientFd = accept(listenFd_, nullptr, nullptr);
+      if (clientFd < 0)
+        return;
+      std::thread(&LocalHttpServer::serve, this, clientFd).detach();
+    }
+  }
+
+  void serve(int clientFd) {
+    // keep-alive, so repeat fetches can reuse the connection
+    std::string request;
+    char buffer[1024];
+    while (true) {
+      size_t end = request.find("\r\n\r\n");
+      if (end == std::string::npos) {
+        ssize_t n = recv(clientFd, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+          break;
+        request.append(buffer, n);
+        continue;
+      }
+      std::string headers = request.substr(0, end);
+      request.erase(0, end + 4);
+
+      // max-age=0 makes every cached copy stale, so clients always revalidate
+      std::ostringstream header;
+      std::string body;
+      if (headers.compare(0, 13, "GET /missing ") == 0) {
+        header << "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+      } else if (headers.compare(0, 15, "GET /truncated ") == 0) {
+        // promises the full payload, then drops the connection half way
+        body = payload_.substr(0, payload_.size() / 2);
+        header << "HTTP/1.1 200 OK\r\nContent-Length: " << payload_.size() << "\r\n\r\n";
+        std::string response = header.str() + body;
+        send(clientFd, response.data(), response.size(), MSG_NOSIGNAL);
+        bodyBytes_ += body.size();
+        break;
+      } else if (headers.compare(0, 15, "GET /unbounded ") == 0) {
+        // no length, the body only ends when the client gives up
+        header << "HTTP/1.1 200 OK\r\nContent-Type: image/jpeg\r\nConnection: close\r\n\r\n";
+        std::string response = header.str() + payload_;
+        ssize_t n = send(clientFd, response.data(), response.size(), MSG_NOSIGNAL);
+        while (n > 0)
+          n = send(clientFd, payload_.data() + 4, payload_.size() - 4, MSG_NOSIGNAL);
+        break;
+      } else if (headers.compare(0, 11, "GET /stall ") == 0) {
+        header << "HTTP/1.1 200 OK\r\nContent-Length: 4096\r\n\r\n" << payload_.substr(0, 16);
+        std::string response = header.str();
+        send(clientFd, response.data(), response.size(), MSG_NOSIGNAL);
+        std::this_thread::sleep_for(std::chrono::seconds(10));
+        break;
+      } else if (headers.compare(0, 14, "GET /notimage ") == 0) {
+        body = "<html><body>" + std::string(4096, ' ') + "</body></html>";
+        header << "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: " << body.size()
+               << "\r\n\r\n";
+      } else if (headers.compare(0, 10, "GET /busy ") == 0) {
+        header << "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n";
+      } else if (headers.find("If-None-Match: " + PAYLOAD_ETAG) != std::string::npos) {
+        header << "HTTP/1.1 304 Not Modified\r\nETag: " << PAYLOAD_ETAG
+               << "\r\nCache-Control: max-age=0\r\n\r\n";
+      } else {
+        body = payload_;
+        header << "HTTP/1.1 200 OK\r\nContent-Type: image/jpeg\r\nETag: " << PAYLOAD_ETAG
+               << "\r\nCache-Control: max-age=0\r\nContent-Length: " << body.size() << "\r\n\r\n";
+      }
+      bodyBytes_ += body.size();
+      std::string response = header.str() + body;
+      size_t sent = 0;
+      while (sent < response.size()) {
+        ssize_t n = send(clientFd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0)
+          break;
+        sent += n;
+      }
+      if (sent < response.size())
+        break;
+    }
+    close(clientFd);
+  }
+
+  int listenFd_ = -1;
+  int port_ = 0;
+  std::string payload_;
+  std::atomic<size_t> bodyBytes_{0};
+};
+
+struct FetchState {
+  GMainLoop *loop;
+  int pending;
+  int failed;
+};
+
+static gboolean onTestTimeout(gpointer data) {
+  std::cout << "timed out waiting for downloads" << std::endl;
+  g_main_loop_quit(static_cast<FetchState *>(data)->loop);
+  return G_SOURCE_REMOVE;
+}
+
+/* 50 parallel fetches on one main loop, no worker threads in the client */
+int test_parallelFetch(const LocalHttpServer &server) {
+  mkdir(OUTPUT_DIR.c_str(), 0755);
+  FetchState state = {g_main_loop_new(nullptr, false), PARALLEL_FETCHES, 0};
+
+  auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < PARALLEL_FETCHES; i++) {
+    std::string url = "http://127.0.0.1:" + std::to_string(server.port()) +
+                      "/cover_" + std::to_string(i) + ".jpg";
+    try {
+      std::unique_ptr<Downloader> downloader = DownloaderFactory::createDownloader(url);
+      downloader->download(url, OUTPUT_DIR,
+        [&state](const DownloadResult &result) {
+          if (!result.success) {
+            std::cout << "failed : " << result.filePath << " " << result.error << std::endl;
+            state.failed++;
+          }
+          if (--state.pending == 0)
+            g_main_loop_quit(state.loop);
+        });
+    } catch (const std::exception &e) {
+      std::cout << "could not start " << url << " : " << e.what() << std::endl;
+      state.failed++;
+      state.pending--;
+    }
+  }
+
+  guint timeoutId = g_timeout_add_seconds(30, onTestTimeout, &state);
+  if (state.pending > 0)
+    g_main_loop_run(state.loop);
+  g_source_remove(timeoutId);
+  g_main_loop_unref(state.loop);
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  int succeeded = PARALLEL_FETCHES - state.failed - state.pending;
+  double megabytes = (double)succeeded * PAYLOAD_SIZE / (1024 * 1024);
+  std::cout << succeeded << "/" << PARALLEL_FETCHES << " fetches in " << seconds * 1000 << " ms, "
+            << megabytes / seconds << " MB/s" << std::endl;
+  return (succeeded == PARALLEL_FETCHES) ? 0 : 1;
+}
+
+struct SequentialState {
+  GMainLoop *loop;
+  std::string baseUrl;
+  int remaining;
+  int failed;
+  std::chrono::steady_clock::time_point started;
+  std::vector<double> elapsedMs;
+};
+
+static void startNextFetch(SequentialState *state);
+
+static void onSequentialFetchDone(SequentialState *state, bool success) {
+  state->elapsedMs.push_back(std::chrono::duration<double, std::milli>(
+      std::chrono::steady_clock::now() - state->started).count());
+  if (!success)
+    state->failed++;
+  if (--state->remaining == 0)
+    g_main_loop_quit(state->loop);
+  else
+    startNextFetch(state);
+}
+
+static void startNextFetch(SequentialState *state) {
+  std::string url = state->baseUrl + (state->baseUrl.find('?') == std::string::npos ? "?n=" : "&n=") +
+                    std::to_string(state->remaining);
+  state->started = std::chrono::steady_clock::now();
+  try {
+    std::unique_ptr<Downloader> downloader = DownloaderFactory::createDownloader(url);
+    downloader->download(url, OUTPUT_DIR + "sequential.jpg",
+      [state](const DownloadResult &result) {
+        if (!result.success)
+          std::cout << "failed : " << result.error << std::endl;
+        onSequentialFetchDone(state, result.success);
+      });
+  } catch (const std::exception &e) {
+    std::cout << "could not start " << url << " : " << e.what() << std::endl;
+    onSequentialFetchDone(state, false);
+  }
+}
+
+/* Repeat fetches from one host, later ones should skip the tcp and tls handshakes.
+   Pass an https url of a local TLS test server to measure the tls session reuse. */
+int test_connectionReuse(const std::string &baseUrl, int count) {
+  mkdir(OUTPUT_DIR.c_str(), 0755);
+  CurlMultiEngine::Stats before = CurlMultiEngine::getInstance().getStats();
+  SequentialState state;
+  state.loop = g_main_loop_new(nullptr, false);
+  state.baseUrl = baseUrl;
+  state.remaining = count;
+  state.failed = 0;
+
+  startNextFetch(&state);
+  g_main_loop_run(state.loop);
+  g_main_loop_unref(state.loop);
+
+  CurlMultiEngine::Stats after = CurlMultiEngine::getInstance().getStats();
+  double repeatMs = 0;
+  for (size_t i = 1; i < state.elapsedMs.size(); i++)
+    repeatMs += state.elapsedMs[i];
+  if (state.elapsedMs.size() > 1)
+    repeatMs /= (state.elapsedMs.size() - 1);
+  unsigned long connects = after.newConnections - before.newConnections;
+  std::cout << count << " sequential fetches from " << baseUrl << " : first " << state.elapsedMs.front()
+            << " ms, repeat avg " << repeatMs << " ms, new connections " << connects << std::endl;
+  return (state.failed == 0 && connects <= 1) ? 0 : 1;
+}
+
+static DownloadResult fetchOnce(const std::string &url, const std::string &outputPath,
+                                const std::string &etag, const std::string &lastModified,
+                                const Downloader::Limits *limits = nullptr) {
+  DownloadResult fetched;
+  GMainLoop *loop = g_main_loop_new(nullptr, false);
+  try {
+    std::unique_ptr<Downloader> downloader = DownloaderFactory::createDownloader(url);
+    downloader->setValidators(etag, lastModified);
+    if (limits != nullptr)
+      downloader->setLimits(*limits);
+    downloader->download(url, outputPath, [&fetched, loop](const DownloadResult &result) {
+      fetched = result;
+      g_main_loop_quit(loop);
+    });
+    g_main_loop_run(loop);
+  } catch (const std::exception &e) {
+    fetched.error = e.what();
+  }
+  g_main_loop_unref(loop);
+  return fetched;
+}
+
+/* A stale copy is revalidated with its ETag, the 304 carries no body */
+int test_revalidation(const LocalHttpServer &server) {
+  mkdir(OUTPUT_DIR.c_str(), 0755);
+  std::string url = "http://127.0.0.1:" + std::to_string(server.port()) + "/revalidate.jpg";
+  std::string outputPath = OUTPUT_DIR + "revalidate.jpg";
+  unlink(outputPath.c_str());
+
+  size_t before = server.bodyBytesSent();
+  DownloadResult first = fetchOnce(url, outputPath, "", "");
+  size_t firstBytes = server.bodyBytesSent() - before;
+  if (!first.success || first.etag != PAYLOAD_ETAG || first.maxAge != 0) {
+    std::cout << "revalidation: first fetch failed : " << first.error << std::endl;
+    return 1;
+  }
+
+  before = server.bodyBytesSent();
+  DownloadResult second = fetchOnce(url, outputPath, first.etag, first.lastModified);
+  size_t secondBytes = server.bodyBytesSent() - before;
+
+  struct stat st;
+  bool intact = (stat(outputPath.c_str(), &st) == 0 && (size_t)st.st_size == PAYLOAD_SIZE);
+  std::cout << "revalidation: full fetch " << firstBytes << " body bytes, conditional fetch "
+            << secondBytes << " body bytes, response " << second.responseCode << std::endl;
+  return (second.success && second.notModified && secondBytes == 0 && intact) ? 0 : 1;
+}
+
+/* Only failures that can go away on their own are worth a retry */
+int test_errorClassification(const LocalHttpServer &server) {
+  std::string base = "http://127.0.0.1:" + std::to_string(server.port());
+  DownloadResult missing = fetchOnce(base + "/missing", OUTPUT_DIR + "missing.jpg", "", "");
+  DownloadResult busy = fetchOnce(base + "/busy", OUTPUT_DIR + "busy.jpg", "", "");
+  DownloadResult refused = fetchOnce("http://127.0.0.1:1/cover.jpg", OUTPUT_DIR + "refused.jpg", "", "");
+  std::cout << "error classification: 404 retryable " << missing.retryable << ", 503 retryable "
+            << busy.retryable << ", refused retryable " << refused.retryable << std::endl;
+  return (!missing.success && !missing.retryable && !busy.success && busy.retryable
+          && !refused.success && refused.retryable) ? 0 : 1;
+}
+
+/* A transfer cut short must leave neither the final file nor its temporary */
+int test_truncatedTransfer(const LocalHttpServer &server) {
+  std::string url = "http://127.0.0.1:" + std::to_string(server.port()) + "/truncated";
+  std::string outputPath = OUTPUT_DIR + "truncated.jpg";
+  unlink(outputPath.c_str());
+  DownloadResult result = fetchOnce(url, outputPath, "", "");
+
+  struct stat st;
+  bool leftover = (stat(outputPath.c_str(), &st) == 0 || stat((outputPath + ".part").c_str(), &st) == 0);
+  std::cout << "truncated transfer: success " << result.success << ", leftover file " << leftover << std::endl;
+  return (!result.success && !leftover) ? 0 : 1;
+}
+
+static std::string readFile(const std::string &path) {
+  std::string content;
+  FILE *file = fopen(path.c_str(), "rb");
+  if (file == nullptr)
+    return content;
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    content.append(buffer, n);
+  fclose(file);
+  return content;
+}
+
+/* file:// and data: sources are stored without curl, outside roots are refused */
+int test_localSources() {
+  mkdir(OUTPUT_DIR.c_str(), 0755);
+  // a root of its own, the fixture stays out of the real media directories
+  const std::string sourceRoot = OUTPUT_DIR + "local-root/";
+  mkdir(sourceRoot.c_str(), 0755);
+  FileDownloader::setLocalRoots({sourceRoot});
+  const std::string sourcePath = sourceRoot + "source.jpg";
+  std::string payload(PAYLOAD_SIZE, 'y');
+  payload.replace(0, 8, "\x89PNG\r\n\x1A\n", 8);
+  FILE *source = fopen(sourcePath.c_str(), "wb");
+  bool created = (source != nullptr && fwrite(payload.data(), 1, payload.size(), source) == payload.size());
+  if (source != nullptr)
+    fclose(source);
+
+  DownloadResult file = fetchOnce("file://" + sourcePath, OUTPUT_DIR + "local.jpg", "", "");
+  unlink(sourcePath.c_str());
+  gchar *digest = g_compute_checksum_for_data(G_CHECKSUM_SHA256, (const guchar *)payload.data(), payload.size());
+  bool fileOk = created && file.success && readFile(file.filePath) == payload &&
+                file.contentDigest == std::string(digest).substr(0, 32);
+  g_free(digest);
+
+  DownloadResult base64 = fetchOnce("data:image/gif;base64,R0lGODlhIGhlbGxvIGNvdmVyIGFydA==", OUTPUT_DIR, "", "");
+  DownloadResult escaped = fetchOnce("data:,GIF89a%20hello%20cover%20art", OUTPUT_DIR + "escaped.gif", "", "");
+  // escaped NULs are part of the payload, not its end
+  DownloadResult binary = fetchOnce("data:,GIF89a%00%01cover%00art%FF", OUTPUT_DIR + "binary.gif", "", "");
+  DownloadResult malformed = fetchOnce("data:,GIF89a%0", OUTPUT_DIR + "malformed.gif", "", "");
+  bool dataOk = base64.success && readFile(base64.filePath) == "GIF89a hello cover art" &&
+                escaped.success && readFile(escaped.filePath) == "GIF89a hello cover art" &&
+                binary.success && readFile(binary.filePath) == std::string("GIF89a\0\x01" "cover\0art\xFF", 18) &&
+                !malformed.success;
+  DownloadResult text = fetchOnce("data:,hello%20cover%20art", OUTPUT_DIR + "text.txt", "", "");
+
+  DownloadResult outside = fetchOnce("file:///etc/passwd", OUTPUT_DIR + "outside.txt", "", "");
+  std::cout << "local sources: file " << fileOk << ", data " << dataOk << " (" << base64.filePath
+            << "), text refused " << !text.success << ", outside root refused " << !outside.success << std::endl;
+  return (fileOk && dataOk && !text.success && !outside.success) ? 0 : 1;
+}
+
+/* Oversized, endless, stalled and non-image responses are cut off early and leave no file.
+   Only the stall is worth a retry */
+int test_abortedTransfers(const LocalHttpServer &server) {
+  std::string base = "http://127.0.0.1:" + std::to_string(server.port());
+  Downloader::Limits limits = {PAYLOAD_SIZE / 4, 2000, 10000, 1024, 1};
+  const struct {
+    const char *path;
+    bool retryable;
+  } cases[] = {{"/oversized.jpg", false}, {"/unbounded", false}, {"/stall", true}, {"/notimage", false}};
+
+  int failures = 0;
+  for (const auto &c : cases) {
+    std::string outputPath = OUTPUT_DIR + "aborted.jpg";
+    unlink(outputPath.c_str());
+    auto begin = std::chrono::steady_clock::now();
+    DownloadResult result = fetchOnce(base + c.path, outputPath, "", "", &limits);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+    struct stat st;
+    bool leftover = (stat(outputPath.c_str(), &st) == 0 || stat((outputPath + ".part").c_str(), &st) == 0);
+    std::cout << "aborted transfer " << c.path << ": " << result.error << " after " << ms << " ms, retryable "
+              << result.retryable << ", leftover file " << leftover << std::endl;
+    if (result.success || result.retryable != c.retryable || leftover || ms > 5000)
+      failures++;
+  }
+  return failures ? 1 : 0;
+}
+
+int main(int argc, char const *argv[]) {
+  if (argc > 1)
+    return test_connectionReuse(argv[1], 20);
+
+  LocalHttpServer server;
+  if (!server.start()) {
+    std::cout << "failed to start local http server" << std::endl;
+    return 1;
+  }
+  std::cout << "local http server on port " << server.port() << std::endl;
+  int result = test_parallelFetch(server);
+  result |= test_connectionReuse("http://127.0.0.1:" + std::to_string(server.port()) + "/cover.jpg", 20);
+  result |= test_revalidation(server);
+  result |= test_errorClassification(server);
+  result |= test_truncatedTransfer(server);
+  result |= test_localSources();
+  result |= test_abortedTransfers(server);
+  return result;
+}
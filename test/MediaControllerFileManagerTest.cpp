@@ -0,0 +1,188 @@
+// Copyright (c) 2024 LG Electronics, Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// SPDX-License-Identifier: Apache-2.0
+//
+/*-----------------------------------------------------------------------------*/
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <sys/stat.h>
+#include <glib.h>
+#include "FileManager.h"
+#include "Utils.h"
+
+const std::string OUTPUT_DIR = "/tmp/mcs-filemanager-test/";
+// 2x2 png, already fits any display edge
+const std::string SMALL_PNG = "data:image/png;base64,"
+    "iVBORw0KGgoAAAANSUhEUgAAAAIAAAACCAIAAAD91JpzAAAAEElEQVR4nGP4z8AARAwQCgAf7gP9i18U1AAAAABJRU5ErkJggg==";
+const int DISPLAY_EDGE = 480;
+// the same image under another uri, so it is not served from the cache
+const std::string RETRY_PNG = "data:image/png;name=retry;base64,"
+    "iVBORw0KGgoAAAANSUhEUgAAAAIAAAACCAIAAAD91JpzAAAAEElEQVR4nGP4z8AARAwQCgAf7gP9i18U1AAAAABJRU5ErkJggg==";
+// fills every download slot, port 1 refuses connections so each attempt fails at once
+const int FAILING_DOWNLOADS = MAX_ACTIVE_DOWNLOADS;
+// well below the shortest backoff of the failing downloads
+const double MAX_GOOD_MS = 1000;
+
+struct Waiter {
+  GMainLoop *loop;
+  int pending;
+  bool timedOut;
+};
+
+static gboolean onTestTimeout(gpointer data) {
+  Waiter *waiter = static_cast<Waiter *>(data);
+  waiter->timedOut = true;
+  g_main_loop_quit(waiter->loop);
+  return G_SOURCE_REMOVE;
+}
+
+// runs the main loop until every pending callback arrived, false on timeout
+static bool waitFor(Waiter &waiter, guint seconds) {
+  waiter.timedOut = false;
+  guint timeoutId = g_timeout_add_seconds(seconds, onTestTimeout, &waiter);
+  if (waiter.pending > 0)
+    g_main_loop_run(waiter.loop);
+  if (!waiter.timedOut)
+    g_source_remove(timeoutId);
+  return !waiter.timedOut;
+}
+
+static void done(Waiter &waiter) {
+  if (--waiter.pending == 0)
+    g_main_loop_quit(waiter.loop);
+}
+
+/* art that already fits the display edge is served as its own variant, and
+   after one request the fast path finds it without another resize */
+int test_fittingVariant(FileManager &fileManager) {
+  Waiter waiter = {g_main_loop_new(nullptr, false), 1, false};
+  std::string filePath;
+  fileManager.requestURI(SMALL_PNG, OUTPUT_DIR, DownloadScheduler::PRIORITY_HIGH,
+    [&](bool downloaded, const std::string &path) {
+      filePath = downloaded ? path : "";
+      done(waiter);
+    });
+  bool fetched = waitFor(waiter, 10) && !filePath.empty();
+
+  std::string variantPath;
+  waiter.pending = 1;
+  fileManager.requestVariant(SMALL_PNG, DISPLAY_EDGE, [&](bool downloaded, const std::string &path) {
+    variantPath = downloaded ? path : "";
+    done(waiter);
+  });
+  bool scaled = waitFor(waiter, 10) && variantPath == filePath;
+  g_main_loop_unref(waiter.loop);
+
+  FileManager::CachedCoverArt paths;
+  bool cached = fileManager.getCachedCoverArt(SMALL_PNG, DISPLAY_EDGE, paths)
+                && paths.filePath == filePath && paths.scaledPath == filePath;
+  std::cout << "fitting variant : fetched " << fetched << ", served as is " << scaled << ", cached " << cached
+            << " " << ((fetched && scaled && cached) ? "PASS" : "FAIL") << std::endl;
+  return (fetched && scaled && cached) ? 0 : 1;
+}
+
+/* downloads waiting to retry give their slot back, so a full set of failing
+   uris does not hold up a good one queued behind them */
+int test_retryReleasesSlot(FileManager &fileManager) {
+  Waiter waiter = {g_main_loop_new(nullptr, false), FAILING_DOWNLOADS + 1, false};
+  gint64 start = g_get_monotonic_time();
+  for (int i = 0; i < FAILING_DOWNLOADS; i++) {
+    std::string uri = "http://127.0.0.1:1/cover" + std::to_string(i) + ".jpg";
+    fileManager.requestURI(uri, OUTPUT_DIR, DownloadScheduler::PRIORITY_NORMAL,
+      [&](bool downloaded, const std::string &path) { done(waiter); });
+  }
+  gint64 goodDone = 0;
+  bool good = false;
+  fileManager.requestURI(RETRY_PNG, OUTPUT_DIR, DownloadScheduler::PRIORITY_NORMAL,
+    [&](bool downloaded, const std::string &path) {
+      good = downloaded;
+      goodDone = g_get_monotonic_time();
+      done(waiter);
+    });
+  // the failing ones have to finish as well, the stats below count every attempt
+  bool finished = waitFor(waiter, DOWNLOAD_DEADLINE_MS / 1000 + 5);
+  g_main_loop_unref(waiter.loop);
+
+  double goodMs = (goodDone - start) / 1000.0;
+  bool fast = good && goodMs < MAX_GOOD_MS;
+  std::cout << "retry slots : good download after " << goodMs << " ms behind " << FAILING_DOWNLOADS
+            << " failing ones, all finished " << finished << " " << ((fast && finished) ? "PASS" : "FAIL")
+            << std::endl;
+  return (fast && finished) ? 0 : 1;
+}
+
+/* counters after the tests above, every download slot was given back */
+int test_stats(FileManager &fileManager) {
+  DownloadScheduler::Stats downloads = fileManager.getDownloadStats();
+  CacheManager::Stats cache = fileManager.getCacheStats();
+  // both images and every attempt of the failing ones
+  bool downloadsOk = downloads.activeJobs == 0 && downloads.queueDepth == 0 && downloads.rejected == 0
+                     && downloads.completed >= static_cast<unsigned long>(FAILING_DOWNLOADS + 2)
+                     && downloads.maxActiveJobs == MAX_ACTIVE_DOWNLOADS;
+  // both images and the marker of the one that fits
+  bool cacheOk = cache.entries == 3 && cache.currentSize > 0 && cache.maxSize == COVERART_CACHE_MAX_SIZE
+                 && cache.freeSpaceFloor == COVERART_FREE_SPACE_FLOOR && cache.evictions == 0;
+  std::cout << "stats : downloads completed " << downloads.completed << " peak queue " << downloads.peakQueueDepth
+            << ", cache entries " << cache.entries << " size " << cache.currentSize << " budget " << cache.budget
+            << " " << ((downloadsOk && cacheOk) ? "PASS" : "FAIL") << std::endl;
+  return (downloadsOk && cacheOk) ? 0 : 1;
+}
+
+/* a file manager going away with a retry timer and a posted result still
+   pending takes both with it, neither callback runs afterwards */
+int test_destroyWithPending() {
+  const std::string dir = OUTPUT_DIR + "destroyed/";
+  mkdir(dir.c_str(), 0755);
+  std::remove((dir + ".cache-journal").c_str());
+  Waiter waiter = {g_main_loop_new(nullptr, false), 1, false};
+  int calls = 0;
+  {
+    FileManager fileManager(dir);
+    fileManager.requestURI("http://127.0.0.1:1/destroyed.jpg", dir, DownloadScheduler::PRIORITY_NORMAL,
+      [&](bool downloaded, const std::string &path) { calls++; });
+    // long enough for the first attempt to fail, well below its retry delay
+    g_timeout_add(RETRY_BASE_DELAY_MS / 4, [](gpointer data) -> gboolean {
+      done(*static_cast<Waiter *>(data));
+      return G_SOURCE_REMOVE;
+    }, &waiter);
+    waitFor(waiter, 5);
+    // not cached, the failure is posted to the next main loop iteration
+    fileManager.requestVariant(SMALL_PNG, DISPLAY_EDGE, [&](bool downloaded, const std::string &path) { calls++; });
+  }
+  // past the longest first retry delay
+  waiter.pending = 1;
+  g_timeout_add(RETRY_BASE_DELAY_MS * 2, [](gpointer data) -> gboolean {
+    done(*static_cast<Waiter *>(data));
+    return G_SOURCE_REMOVE;
+  }, &waiter);
+  bool finished = waitFor(waiter, 5);
+  g_main_loop_unref(waiter.loop);
+
+  bool pass = finished && calls == 0;
+  std::cout << "destroy with pending : callbacks run " << calls << " " << (pass ? "PASS" : "FAIL") << std::endl;
+  return pass ? 0 : 1;
+}
+
+int main(int argc, char const *argv[]) {
+  mkdir(OUTPUT_DIR.c_str(), 0755);
+  std::remove((OUTPUT_DIR + ".cache-journal").c_str());
+  FileManager fileManager(OUTPUT_DIR);
+  int result = test_fittingVariant(fileManager);
+  result |= test_retryReleasesSlot(fileManager);
+  result |= test_stats(fileManager);
+  result |= test_destroyWithPending();
+  return result;
+}
@@ -46,6 +46,29 @@ void printOutput(std::string uri, int &test_count){
   test_count++;
 }
 
+/* sends back the version of a first reply, after a position update, and expects
+   the notModified reply. position ticks do not count as a change for pollers */
+void testNotModified(const std::string &api, int &test_count) {
+  std::string uri = serviceUri + api + "'{\"mediaId\":\"xDFNUI\"}'";
+  std::cout << uri << std::endl;
+  std::string first = executeCommand(std::move(uri));
+  std::cout << first << std::endl;
+  size_t pos = first.find("\"version\":");
+  std::string version = (pos == std::string::npos) ? "" : std::to_string(std::stoll(first.substr(pos + 10)));
+  test_count++;
+
+  uri = serviceUri + "setMediaPlayPosition '{\"mediaId\":\"xDFNUI\",\"playPosition\":\"12.5\"}'";
+  printOutput(std::move(uri), test_count);
+
+  uri = serviceUri + api + "'{\"mediaId\":\"xDFNUI\",\"ifNoneMatch\":" + version + "}'";
+  std::cout << uri << std::endl;
+  std::string second = executeCommand(std::move(uri));
+  std::cout << second << std::endl;
+  bool notModified = !version.empty() && second.find("\"notModified\": true") != std::string::npos;
+  std::cout << api << "with version " << version << (notModified ? " PASS" : " FAIL") << std::endl;
+  test_count++;
+}
+
 /* This function will cover both valid and invalid cases and TC count for each API*/
 void test_registerMediaSession() {
   int test_count = 0;
@@ -88,6 +111,11 @@ void test_getMediaMetaData() {
   /*Valid test case*/
   std::string uri = serviceUri + api + "'{\"mediaId\":\"xDFNUI\"}'";
   printOutput(uri, test_count);
+  /*conditional query with a stale version, full payload with new version expected*/
+  uri = serviceUri + api + "'{\"mediaId\":\"xDFNUI\",\"ifNoneMatch\":1}'";
+  printOutput(uri, test_count);
+  /*conditional query with the current version, notModified expected*/
+  testNotModified(api, test_count);
   /*invalid Media ID */
   uri = serviceUri + api + "'{\"mediaId\":\"xDLNR\"}'";
   printOutput(uri, test_count);
@@ -104,6 +132,11 @@ void test_getMediaPlayStatus() {
   /*Valid test case*/
   std::string uri = serviceUri + api + "'{\"mediaId\":\"xDFNUI\"}'";
   printOutput(uri, test_count);
+  /*conditional query with a stale version, full payload with new version expected*/
+  uri = serviceUri + api + "'{\"mediaId\":\"xDFNUI\",\"ifNoneMatch\":1}'";
+  printOutput(uri, test_count);
+  /*conditional query with the current version, notModified expected*/
+  testNotModified(api, test_count);
   /*invalid Media ID */
   uri = serviceUri + api + "'{\"mediaId\":\"xDLNR\"}'";
   printOutput(uri, test_count);
@@ -120,6 +153,11 @@ void test_getMediaSessionInfo() {
   /*Valid test case*/
   std::string uri = serviceUri + api + "'{\"mediaId\":\"xDFNUI\"}'";
   printOutput(uri, test_count);
+  /*conditional query with a stale version, full payload with new version expected*/
+  uri = serviceUri + api + "'{\"mediaId\":\"xDFNUI\",\"ifNoneMatch\":1}'";
+  printOutput(uri, test_count);
+  /*conditional query with the current version, notModified expected*/
+  testNotModified(api, test_count);
   /*invalid Media ID */
   uri = serviceUri + api + "'{\"mediaId\":\"xDLNR\"}'";
   printOutput(uri, test_count);
@@ -159,6 +197,26 @@ void test_getActiveMediaSessions() {
   std::cout << test_count << " cases executed." << std::endl;
 }
 
+void test_getMediaSessionSnapshot() {
+  int test_count = 0;
+  std::string api = "getMediaSessionSnapshot ";
+  /*Valid test case, all sessions with all fields*/
+  std::string uri = serviceUri + api + "'{}'";
+  printOutput(uri, test_count);
+  /*Valid test case, filtered by appId with selected fields and paging*/
+  uri = serviceUri + api + "'{\"appId\":\"com.webos.app.test.youtube\","
+    "\"fields\":[\"metaData\",\"playStatus\"],\"offset\":0,\"limit\":1}'";
+  printOutput(uri, test_count);
+  /*invalid field name*/
+  uri = serviceUri + api + "'{\"fields\":[\"lyrics\"]}'";
+  printOutput(uri, test_count);
+  /*invalid parsing expecting integer put passing string*/
+  uri = serviceUri + api + "'{\"limit\":\"10\"}'";
+  printOutput(std::move(uri), test_count);
+
+  std::cout << test_count << " cases executed." << std::endl;
+}
+
 void test_setMediaMetaData() {
   int test_count = 0;
   std::string api = "setMediaMetaData ";
@@ -237,6 +295,64 @@ void test_unregisterMediaSession() {
   std::cout << test_count << " cases executed." << std::endl;
 }
 
+void test_registerMediaSessions() {
+  int test_count = 0;
+  std::string api = "registerMediaSessions ";
+  /*Valid test case, one client registering two sessions*/
+  std::string uri = serviceUri + api + "'{\"sessions\":[{\"mediaId\":\"xBATCH1\","
+    "\"appId\":\"com.webos.app.test.youtube\"},{\"mediaId\":\"xBATCH2\","
+    "\"appId\":\"com.webos.app.test.youtube\"}],\"subscribe\":true}'";
+  printOutput(uri, test_count);
+  /*partially invalid case, xBATCH1 already registered*/
+  uri = serviceUri + api + "'{\"sessions\":[{\"mediaId\":\"xBATCH1\","
+    "\"appId\":\"com.webos.app.test.youtube\"},{\"mediaId\":\"xBATCH3\","
+    "\"appId\":\"com.webos.app.test.youtube\"}],\"subscribe\":true}'";
+  printOutput(uri, test_count);
+  /*invalid parsing expecting string put passing integer*/
+  uri = serviceUri + api + "'{\"sessions\":[{\"mediaId\":68754,"
+    "\"appId\":\"com.webos.app.test.youtube\"}],\"subscribe\":true}'";
+  printOutput(std::move(uri), test_count);
+
+  std::cout << test_count << " cases executed." << std::endl;
+}
+
+void test_unregisterMediaSessions() {
+  int test_count = 0;
+  std::string api = "unregisterMediaSessions ";
+  /*Valid test case*/
+  std::string uri = serviceUri + api + "'{\"mediaIds\":[\"xBATCH1\",\"xBATCH2\",\"xBATCH3\"]}'";
+  printOutput(uri, test_count);
+  /*invalid case, already unregistered media IDs*/
+  uri = serviceUri + api + "'{\"mediaIds\":[\"xBATCH1\",\"xBATCH2\"]}'";
+  printOutput(uri, test_count);
+  /*invalid parsing expecting array put passing string*/
+  uri = serviceUri + api + "'{\"mediaIds\":\"xBATCH1\"}'";
+  printOutput(std::move(uri), test_count);
+
+  std::cout << test_count << " cases executed." << std::endl;
+}
+
+/* Needs the session from registerMediaSession and activateMediaSession. Each
+   subscriber asks for its own unreachable uri, so every request completes with
+   a failure after its retries. Every subscriber should get its first reply and
+   its own completion only, twice the requesters in total. Broadcast results
+   would grow with requesters x subscribers instead */
+void test_getMediaCoverArtPath() {
+  const int requesters = 10;
+  std::string cmd = "{ ";
+  for (int i = 0; i < requesters; i++) {
+    cmd += "luna-send -n " + std::to_string(requesters + 1) + " -w 10000 "
+           "luna://com.webos.service.mediacontroller/getMediaCoverArtPath "
+           "'{\"displayId\":0,\"subscribe\":true,\"src\":[\"http://127.0.0.1:1/fanout_" +
+           std::to_string(i) + ".jpg\"]}' & ";
+  }
+  cmd += "wait; } | grep -c returnValue";
+  std::cout << cmd << std::endl;
+  int replies = std::stoi("0" + executeCommand(std::move(cmd)));
+  std::cout << replies << " replies for " << requesters << " requesters, expected "
+            << requesters * 2 << (replies == requesters * 2 ? " PASS" : " FAIL") << std::endl;
+}
+
 int main(int argc, char const *argv[]) {
     int choice = -1;
     bool flag=true;
@@ -247,8 +363,10 @@ int main(int argc, char const *argv[]) {
         std::cout << "5. getMediaMetaData" << std::endl << "6. getMediaPlayStatus" << std::endl;
         std::cout << "7. getMediaSessionInfo" << std::endl << "8. getMediaSessionId" << std::endl;
         std::cout << "9. getActiveMediaSessions" << std::endl << "10. deactivateMediaSession" << std::endl;
-        std::cout << "11. unregisterMediaSession" << std::endl << "12.Execute all test case"<< std::endl;
-        std::cout << "13.Exit" << std::endl;
+        std::cout << "11. unregisterMediaSession" << std::endl << "12. getMediaSessionSnapshot" << std::endl;
+        std::cout << "13. registerMediaSessions" << std::endl << "14. unregisterMediaSessions" << std::endl;
+        std::cout << "15. getMediaCoverArtPath" << std::endl;
+        std::cout << "16.Execute all test case"<< std::endl << "17.Exit" << std::endl;
     std::cin >> choice;
     switch (choice) {
     case 1:
@@ -285,6 +403,18 @@ int main(int argc, char const *argv[]) {
       test_unregisterMediaSession();
       break;
     case 12:
+      test_getMediaSessionSnapshot();
+      break;
+    case 13:
+      test_registerMediaSessions();
+      break;
+    case 14:
+      test_unregisterMediaSessions();
+      break;
+    case 15:
+      test_getMediaCoverArtPath();
+      break;
+    case 16:
       test_registerMediaSession();
       test_activateMediaSession();
       test_setMediaMetaData();
@@ -294,10 +424,14 @@ int main(int argc, char const *argv[]) {
       test_getMediaSessionInfo();
       test_getMediaSessionId();
       test_getActiveMediaSessions();
+      test_getMediaSessionSnapshot();
+      test_getMediaCoverArtPath();
       test_deactivateMediaSession();
       test_unregisterMediaSession();
+      test_registerMediaSessions();
+      test_unregisterMediaSessions();
       break;
-    case 13:
+    case 17:
       flag = false;
       break;
     default: